@@ -5,6 +5,8 @@
 #define CMARK_NO_SHORT_NAMES
 #include "cmark.h"
 #include "node.h"
+#include "parser.h"
+#include "utf8.h"
 
 #include "harness.h"
 #include "cplusplus.h"
@@ -1154,6 +1156,1365 @@ static void ref_source_pos(test_batch_runner *runner) {
   cmark_node_free(doc);
 }
 
+static void arena_allocator(test_batch_runner *runner) {
+  static const char markdown[] = "# Heading\n"
+                                 "\n"
+                                 "Some *emphasis* and a [link][ref].\n"
+                                 "\n"
+                                 "[ref]: /url \"title\"\n";
+  cmark_mem *mem = cmark_get_arena_mem_allocator();
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    cmark_parser *parser = cmark_parser_new_with_mem(CMARK_OPT_DEFAULT, mem);
+    cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+    cmark_node *doc = cmark_parser_finish(parser);
+    cmark_parser_free(parser);
+
+    OK(runner, doc->mem == mem, "document uses arena allocator");
+    char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+    STR_EQ(runner, html,
+           "<h1>Heading</h1>\n"
+           "<p>Some <em>emphasis</em> and a "
+           "<a href=\"/url\" title=\"title\">link</a>.</p>\n",
+           "render from arena, pass %d", i);
+    // Freeing nodes individually is allowed but does nothing.
+    cmark_node_free(cmark_node_first_child(doc));
+    cmark_arena_reset();
+  }
+
+  // Large allocations get their own chunk.
+  char *big = (char *)mem->calloc(1, 8 * 1024 * 1024);
+  OK(runner, big[0] == 0 && big[8 * 1024 * 1024 - 1] == 0,
+     "large arena allocation is zeroed");
+  char *grown = (char *)mem->realloc(NULL, 10);
+  memcpy(grown, "123456789", 10);
+  grown = (char *)mem->realloc(grown, 100000);
+  STR_EQ(runner, grown, "123456789", "arena realloc preserves contents");
+  cmark_arena_release();
+}
+
+static void counting_allocator(test_batch_runner *runner) {
+  static const char markdown[] = "# Heading\n"
+                                 "\n"
+                                 "Some *emphasis* and a [link][ref].\n"
+                                 "\n"
+                                 "[ref]: /url \"title\"\n";
+  cmark_mem *mem = cmark_counting_mem_new(cmark_get_default_mem_allocator());
+  cmark_mem_stats stats = cmark_counting_mem_stats(mem);
+  INT_EQ(runner, (int)stats.peak, 0, "new counting allocator is empty");
+
+  cmark_parser *parser = cmark_parser_new_with_mem(CMARK_OPT_DEFAULT, mem);
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  cmark_node *doc = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+  char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  stats = cmark_counting_mem_stats(mem);
+  OK(runner, stats.current > 0, "document and output are counted");
+  OK(runner, stats.peak >= stats.current, "peak is at least current");
+  OK(runner, stats.allocations > 0, "allocations are counted");
+  OK(runner, stats.largest > 0 && stats.largest <= stats.peak,
+     "largest block is within peak");
+
+  char *grown = (char *)mem->realloc(NULL, 10);
+  grown = (char *)mem->realloc(grown, 1000);
+  OK(runner, cmark_counting_mem_stats(mem).reallocations ==
+                 stats.reallocations + 1,
+     "reallocations are counted");
+  OK(runner, cmark_counting_mem_stats(mem).current == stats.current + 1000,
+     "resized block is counted at its new size");
+  mem->free(grown);
+
+  mem->free(html);
+  cmark_node_free(doc);
+  stats = cmark_counting_mem_stats(mem);
+  INT_EQ(runner, (int)stats.current, 0, "everything is freed");
+  cmark_counting_mem_free(mem);
+
+  // Counting allocators nest, and each one allocates from its base.
+  cmark_mem *outer = cmark_counting_mem_new(cmark_get_default_mem_allocator());
+  cmark_mem *inner = cmark_counting_mem_new(outer);
+  void *block = inner->calloc(1, 100);
+  INT_EQ(runner, (int)cmark_counting_mem_stats(inner).current, 100,
+         "inner counting allocator is charged");
+  OK(runner, cmark_counting_mem_stats(outer).current > 100,
+     "inner counting allocator allocates from its base");
+  inner->free(block);
+  cmark_counting_mem_free(inner);
+  INT_EQ(runner, (int)cmark_counting_mem_stats(outer).current, 0,
+         "inner counting allocator is freed through its base");
+  block = outer->calloc(1, 50);
+  INT_EQ(runner, (int)cmark_counting_mem_stats(outer).current, 50,
+         "outer counting allocator counts again once inner is freed");
+  outer->free(block);
+  cmark_counting_mem_free(outer);
+}
+
+static void memory_limit(test_batch_runner *runner) {
+  static char buf[100000];
+  size_t len = 0, pos;
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_node *doc, *node;
+  char *html;
+  int i, paras;
+
+  for (i = 0; i < 2000; i++)
+    len += sprintf(buf + len, "[%d]: /url%d\n\nParagraph *%d*.\n\n", i, i, i);
+
+  cmark_parser_feed(parser, buf, len);
+  doc = cmark_parser_finish(parser);
+  OK(runner, !cmark_node_is_truncated(doc), "no limit by default");
+  cmark_node_free(doc);
+
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_set_memory_limit(parser, 50000);
+  for (pos = 0; pos < len; pos += 1000)
+    cmark_parser_feed(parser, buf + pos, len - pos < 1000 ? len - pos : 1000);
+  doc = cmark_parser_finish(parser);
+  OK(runner, cmark_node_is_truncated(doc), "document is truncated");
+  paras = 0;
+  for (node = cmark_node_first_child(doc); node; node = cmark_node_next(node))
+    paras++;
+  OK(runner, paras > 10 && paras < 2000, "truncated document keeps %d blocks",
+     paras);
+  html = cmark_render_html(cmark_node_first_child(doc), CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, "<p>Paragraph <em>0</em>.</p>\n",
+         "truncated document starts like the full one");
+  free(html);
+  cmark_node_free(doc);
+
+  // The limit is kept across documents.
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, buf, len);
+  doc = cmark_parser_finish(parser);
+  OK(runner, cmark_node_is_truncated(doc), "limit is kept by reset");
+  cmark_node_free(doc);
+
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, "small\n", 6);
+  doc = cmark_parser_finish(parser);
+  OK(runner, !cmark_node_is_truncated(doc), "small document fits");
+  cmark_node_free(doc);
+
+  // Links to a long destination take much more memory as inlines than
+  // as source.
+  len = sprintf(buf, "[a]: /");
+  for (i = 0; i < 4000; i++)
+    buf[len++] = 'u';
+  len += sprintf(buf + len, "\n\n");
+  for (i = 0; i < 20; i++)
+    len += sprintf(buf + len, "[a] [a]\n\n");
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, buf, len);
+  doc = cmark_parser_finish(parser);
+  OK(runner, cmark_node_is_truncated(doc), "inline text counts to the limit");
+  cmark_node_free(doc);
+
+  // A document may outlive the reset that starts the next one.
+  len = 0;
+  for (i = 0; i < 1000; i++)
+    len += sprintf(buf + len, "- item %d\n", i);
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_set_memory_limit(parser, 1000000);
+  cmark_parser_feed(parser, buf, len);
+  doc = cmark_parser_finish(parser);
+  OK(runner, !cmark_node_is_truncated(doc), "list fits in the limit");
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_node_free(doc);
+  cmark_parser_feed(parser, "hello *world*\n", 14);
+  doc = cmark_parser_finish(parser);
+  OK(runner, !cmark_node_is_truncated(doc),
+     "document freed after reset isn't counted");
+  html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, "<p>hello <em>world</em></p>\n",
+         "document after reset and free is complete");
+  free(html);
+  cmark_node_free(doc);
+
+  // Buffers grown by an earlier document aren't counted.
+  memset(buf, 'x', 60000);
+  buf[60000] = '\n';
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, buf, 60001);
+  cmark_node_free(cmark_parser_finish(parser));
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_set_memory_limit(parser, 50000);
+  cmark_parser_feed(parser, "small\n", 6);
+  doc = cmark_parser_finish(parser);
+  OK(runner, !cmark_node_is_truncated(doc),
+     "buffers kept from an earlier document aren't counted");
+  cmark_node_free(doc);
+
+  cmark_parser_free(parser);
+}
+
+static void parser_reset(test_batch_runner *runner) {
+  static const char *const docs[] = {
+      "[a]: /one\n\n[a] *b*\n",
+      "> ```\n> code\n",
+      "[a]\n",
+      "- x\n\n  y\r\n",
+  };
+  int i;
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+
+  for (i = 0; i < (int)(sizeof(docs) / sizeof(*docs)); i++) {
+    char *expected = cmark_markdown_to_html(docs[i], strlen(docs[i]),
+                                            CMARK_OPT_SOURCEPOS);
+    cmark_parser_reset(parser, CMARK_OPT_SOURCEPOS);
+    // Leave a parse unfinished on odd passes to make sure reset
+    // discards partial input.
+    if (i % 2) {
+      cmark_parser_feed(parser, "[a]: /two\n- item", 16);
+      cmark_parser_reset(parser, CMARK_OPT_SOURCEPOS);
+    }
+    cmark_parser_feed(parser, docs[i], strlen(docs[i]));
+    cmark_node *doc = cmark_parser_finish(parser);
+    char *html = cmark_render_html(doc, CMARK_OPT_SOURCEPOS);
+    STR_EQ(runner, html, expected, "reused parser, document %d", i);
+    free(html);
+    free(expected);
+    cmark_node_free(doc);
+  }
+
+  // References don't leak from one document into the next, but the
+  // storage of the reference map is kept.
+  cmark_reference **table = parser->refmap->table;
+  cmark_reference_cache_entry *cache = parser->refmap->cache;
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  OK(runner, table && parser->refmap->table == table &&
+                 parser->refmap->cache == cache && cache,
+     "reset keeps the reference table and cache");
+  cmark_parser_feed(parser, "[a]\n", 4);
+  cmark_node *doc = cmark_parser_finish(parser);
+  char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, "<p>[a]</p>\n", "references cleared on reset");
+  free(html);
+  cmark_node_free(doc);
+
+  cmark_parser_free(parser);
+
+  // A root given by the caller stays the caller's.
+  cmark_node *root = cmark_node_new(CMARK_NODE_DOCUMENT);
+  parser = cmark_parser_new_with_mem_into_root(
+      CMARK_OPT_DEFAULT, cmark_get_default_mem_allocator(), root);
+  cmark_parser_feed(parser, "# Head\n\npara", 13);
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, "other\n", 6);
+  cmark_node_free(cmark_parser_finish(parser));
+  cmark_parser_free(parser);
+  OK(runner, cmark_node_get_type(cmark_node_first_child(root)) ==
+                 CMARK_NODE_HEADING,
+     "reset keeps a root given by the caller");
+  cmark_node_free(root);
+}
+
+static void compact_tree(test_batch_runner *runner) {
+  static const char markdown[] = "# Title\n"
+                                 "\n"
+                                 "> - one *two* [three](/url)\n"
+                                 ">\n"
+                                 ">   four `five`\n"
+                                 "\n"
+                                 "    code\n";
+  cmark_node *doc =
+      cmark_parse_document(markdown, sizeof(markdown) - 1, CMARK_OPT_COMPACT);
+  char *expected =
+      cmark_markdown_to_html(markdown, sizeof(markdown) - 1, CMARK_OPT_DEFAULT);
+  char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, expected, "compact document renders the same");
+  free(html);
+  INT_EQ(runner, cmark_node_check(doc, stderr), 0, "compact tree is valid");
+
+  // The document owns the pool its nodes came from.
+  cmark_iter *iter = cmark_iter_new(doc);
+  int pooled = 1;
+  cmark_iter_next(iter);
+  while (cmark_iter_next(iter) != CMARK_EVENT_DONE) {
+    cmark_node *cur = cmark_iter_get_node(iter);
+    if (cur != doc && !(cur->flags & CMARK_NODE__POOLED))
+      pooled = 0;
+  }
+  cmark_iter_free(iter);
+  OK(runner, pooled && doc->as.document.pool != NULL,
+     "compact document owns its nodes' pool");
+
+  // The tree can still be edited.
+  cmark_node *quote = cmark_node_next(cmark_node_first_child(doc));
+  cmark_node_free(cmark_node_first_child(quote));
+  cmark_node *para = cmark_node_new(CMARK_NODE_PARAGRAPH);
+  cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
+  cmark_node_set_literal(text, "new");
+  cmark_node_append_child(para, text);
+  cmark_node_append_child(quote, para);
+  cmark_node_set_literal(cmark_node_first_child(cmark_node_first_child(doc)),
+                         "Renamed");
+  html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html,
+         "<h1>Renamed</h1>\n"
+         "<blockquote>\n"
+         "<p>new</p>\n"
+         "</blockquote>\n"
+         "<pre><code>code\n"
+         "</code></pre>\n",
+         "edit compact document");
+  free(html);
+  cmark_node_free(doc);
+
+  // Each document of a reused parser gets a pool of its own, and may
+  // outlive the parser.
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_COMPACT);
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  cmark_node *first = cmark_parser_finish(parser);
+  cmark_parser_reset(parser, CMARK_OPT_COMPACT);
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  doc = cmark_parser_finish(parser);
+  OK(runner, first->as.document.pool != doc->as.document.pool,
+     "compact documents don't share a pool");
+  cmark_parser_free(parser);
+  cmark_node_free(first);
+  html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, expected,
+         "compact document outlives its parser and sibling");
+  free(html);
+  free(expected);
+  cmark_node_free(doc);
+}
+
+static void node_pool(test_batch_runner *runner) {
+  static const char markdown[] = "- a *b* c\n- d\n\n> e\n";
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  cmark_node *doc = cmark_parser_finish(parser);
+
+  cmark_node *list = cmark_node_first_child(doc);
+  OK(runner, list->flags & CMARK_NODE__POOLED, "parsed nodes are pooled");
+  cmark_node *item = cmark_node_first_child(list);
+  cmark_node *emph =
+      cmark_node_next(cmark_node_first_child(cmark_node_first_child(item)));
+  INT_EQ(runner, cmark_node_get_type(emph), CMARK_NODE_EMPH,
+         "inline nodes are pooled too");
+  OK(runner, emph->flags & CMARK_NODE__POOLED, "inline nodes are pooled");
+
+  // Freed nodes are handed out again for the next document.
+  cmark_node *old_nodes[32];
+  int num_old = 0, reused = 0, i;
+  cmark_iter *iter = cmark_iter_new(doc);
+  while (cmark_iter_next(iter) != CMARK_EVENT_DONE && num_old < 32)
+    old_nodes[num_old++] = cmark_iter_get_node(iter);
+  cmark_iter_free(iter);
+  cmark_node_free(doc);
+  cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+  cmark_parser_feed(parser, markdown, sizeof(markdown) - 1);
+  doc = cmark_parser_finish(parser);
+  for (i = 0; i < num_old; i++) {
+    if (old_nodes[i] == cmark_node_first_child(doc))
+      reused = 1;
+  }
+  OK(runner, reused, "freed nodes are reused");
+
+  // Nodes outlive the parser and can still be freed one by one.
+  cmark_parser_free(parser);
+  cmark_node_free(cmark_node_first_child(doc));
+  char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, "<blockquote>\n<p>e</p>\n</blockquote>\n",
+         "pooled nodes freed after parser");
+  free(html);
+  cmark_node_free(doc);
+}
+
+static void borrow_input(test_batch_runner *runner) {
+  static const char markdown[] = "Some *emph* and `code` here\n"
+                                 "next line.\n"
+                                 "\n"
+                                 "    indented\n"
+                                 "\n"
+                                 "# Title #\n";
+  cmark_node *doc = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                         CMARK_OPT_BORROW_INPUT);
+  char *expected = cmark_markdown_to_html(markdown, sizeof(markdown) - 1,
+                                          CMARK_OPT_DEFAULT);
+  char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, expected, "borrowed document renders the same");
+  free(html);
+  free(expected);
+
+  cmark_node *para = cmark_node_first_child(doc);
+  cmark_node *text = cmark_node_first_child(para);
+  OK(runner, text->flags & CMARK_NODE__BORROWED, "text is borrowed");
+  OK(runner, (const char *)text->data == markdown, "text points into input");
+  INT_EQ(runner, text->len, 5, "borrowed text length");
+  cmark_node *code = cmark_node_next(cmark_node_next(cmark_node_next(text)));
+  OK(runner, (const char *)code->data == markdown + 17,
+     "code span points into input");
+  cmark_node *code_block = cmark_node_next(para);
+  OK(runner, (const char *)code_block->data == markdown + 44,
+     "code block points into input");
+  cmark_node *heading_text = cmark_node_first_child(cmark_node_last_child(doc));
+  OK(runner, (const char *)heading_text->data == markdown + 56,
+     "heading text points into input");
+
+  // The renderers read borrowed literals in place.
+  cmark_node *copy = cmark_parse_document(markdown, sizeof(markdown) - 1,
+                                          CMARK_OPT_DEFAULT);
+  char *(*renderers[])(cmark_node *, int, int) = {
+      cmark_render_commonmark, cmark_render_latex, cmark_render_man};
+  size_t i;
+  for (i = 0; i < sizeof(renderers) / sizeof(*renderers); i++) {
+    html = renderers[i](doc, CMARK_OPT_DEFAULT, 20);
+    expected = renderers[i](copy, CMARK_OPT_DEFAULT, 20);
+    STR_EQ(runner, html, expected, "borrowed document renders the same (%d)",
+           (int)i);
+    free(html);
+    free(expected);
+  }
+  cmark_node_free(copy);
+  OK(runner,
+     (text->flags & code->flags & code_block->flags & heading_text->flags) &
+         CMARK_NODE__BORROWED,
+     "rendering leaves literals borrowed");
+
+  size_t len;
+  const char *literal = cmark_node_get_literal_with_len(text, &len);
+  OK(runner, literal == markdown && len == 5,
+     "get_literal_with_len reads borrowed text in place");
+  OK(runner, text->flags & CMARK_NODE__BORROWED,
+     "get_literal_with_len leaves text borrowed");
+  OK(runner, cmark_node_get_literal_with_len(para, &len) == NULL && len == 0,
+     "get_literal_with_len error");
+
+  // Literals are copied when a NUL-terminated string is needed or
+  // when they are modified.
+  STR_EQ(runner, cmark_node_get_literal(text), "Some ",
+         "get_literal on borrowed text");
+  OK(runner, !(text->flags & CMARK_NODE__BORROWED), "text is copied");
+  cmark_node_set_literal(code, "other");
+  STR_EQ(runner, cmark_node_get_literal(heading_text), "Title",
+         "get_literal on borrowed heading text");
+  html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html,
+         "<p>Some <em>emph</em> and <code>other</code> here\n"
+         "next line.</p>\n"
+         "<pre><code>indented\n"
+         "</code></pre>\n"
+         "<h1>Title</h1>\n",
+         "render after modifying borrowed literals");
+  free(html);
+  cmark_node_free(doc);
+}
+
+static void short_literals(test_batch_runner *runner) {
+  static const char markdown[] = "*a* `b` <i>\n"
+                                 "a longer piece of text\n";
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    int options = i ? CMARK_OPT_UNSAFE | CMARK_OPT_COMPACT : CMARK_OPT_UNSAFE;
+    cmark_node *doc =
+        cmark_parse_document(markdown, sizeof(markdown) - 1, options);
+    cmark_node *emph = cmark_node_first_child(cmark_node_first_child(doc));
+    cmark_node *text = cmark_node_first_child(emph);
+    cmark_node *code = cmark_node_next(cmark_node_next(emph));
+    cmark_node *html = cmark_node_next(cmark_node_next(code));
+    cmark_node *longer = cmark_node_next(cmark_node_next(html));
+
+    OK(runner, text->data == text->as.literal, "short text is in the node");
+    OK(runner, code->data == code->as.literal, "short code is in the node");
+    OK(runner, html->data == html->as.literal, "short html is in the node");
+    OK(runner, longer->data != longer->as.literal, "long text is not");
+    STR_EQ(runner, cmark_node_get_literal(text), "a", "get short text");
+    STR_EQ(runner, cmark_node_get_literal(code), "b", "get short code");
+    STR_EQ(runner, cmark_node_get_literal(html), "<i>", "get short html");
+
+    cmark_node_set_literal(code, "replaced");
+    char *out = cmark_render_html(doc, CMARK_OPT_UNSAFE);
+    STR_EQ(runner, out,
+           "<p><em>a</em> <code>replaced</code> <i>\n"
+           "a longer piece of text</p>\n",
+           "render short literals");
+    free(out);
+    cmark_node_free(doc);
+  }
+}
+
+static void in_place_input(test_batch_runner *runner) {
+  static const char markdown[] = "<div>\n"
+                                 "block\n"
+                                 "</div>\n"
+                                 "\n"
+                                 "[a](/url \"title\") <http://x.y> <b>inline</b>\n"
+                                 "Setext\n"
+                                 "---\n"
+                                 "```info\n"
+                                 "fenced\n"
+                                 "```\n"
+                                 "> quote\n"
+                                 "lazy `code`\n"
+                                 "\n"
+                                 "[ref]: /dest\n"
+                                 "[ref]";
+  size_t len = sizeof(markdown) - 1;
+  // No NUL after the input, so the scanners can't rely on one.
+  char *buf = (char *)malloc(len);
+  cmark_parser *parser;
+  cmark_node *doc;
+  char *expected, *html;
+  size_t i;
+  int options[] = {CMARK_OPT_UNSAFE,
+                   CMARK_OPT_UNSAFE | CMARK_OPT_BORROW_INPUT};
+
+  // The streaming parser copies every line.
+  parser = cmark_parser_new(CMARK_OPT_UNSAFE);
+  for (i = 0; i < len; i += 7)
+    cmark_parser_feed(parser, markdown + i, len - i < 7 ? len - i : 7);
+  doc = cmark_parser_finish(parser);
+  expected = cmark_render_html(doc, CMARK_OPT_UNSAFE);
+  cmark_node_free(doc);
+  cmark_parser_free(parser);
+
+  memcpy(buf, markdown, len);
+  for (i = 0; i < sizeof(options) / sizeof(*options); i++) {
+    doc = cmark_parse_document(buf, len, options[i]);
+    html = cmark_render_html(doc, CMARK_OPT_UNSAFE);
+    STR_EQ(runner, html, expected, "in-place parse renders the same");
+    free(html);
+    cmark_node_free(doc);
+    OK(runner, memcmp(buf, markdown, len) == 0, "input is left untouched");
+  }
+
+  free(buf);
+  free(expected);
+
+  // A paragraph left over after a reference definition, spanning more
+  // lines than the definition.
+  html = cmark_markdown_to_html("[x]: u\nfoo\nbar\n", 15, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, "<p>foo\nbar</p>\n",
+         "paragraph after reference definition is kept");
+  free(html);
+}
+
+static void render_context(test_batch_runner *runner) {
+  static const char *const docs[] = {
+      "# Heading\n\n- *one*\n- two\n\n> quote\n",
+      "",
+      "para with `code` and [a link](/url)\n\n    indented\n",
+  };
+  cmark_render_context *ctx = cmark_render_context_new(NULL);
+  const char *first = NULL;
+  size_t i, len;
+  char *expected;
+
+  for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+    cmark_node *doc = cmark_parse_document(docs[i], strlen(docs[i]), 0);
+
+    len = cmark_render_context_html(ctx, doc, 0);
+    expected = cmark_render_html(doc, 0);
+    STR_EQ(runner, cmark_render_context_output(ctx), expected,
+           "context html matches cmark_render_html");
+    INT_EQ(runner, (int)len, (int)strlen(expected), "context html length");
+    free(expected);
+
+    len = cmark_render_context_xml(ctx, doc, 0);
+    expected = cmark_render_xml(doc, 0);
+    STR_EQ(runner, cmark_render_context_output(ctx), expected,
+           "context xml matches cmark_render_xml");
+    INT_EQ(runner, (int)len, (int)strlen(expected), "context xml length");
+    free(expected);
+
+    len = cmark_render_context_commonmark(ctx, doc, 0, 20);
+    expected = cmark_render_commonmark(doc, 0, 20);
+    STR_EQ(runner, cmark_render_context_output(ctx), expected,
+           "context commonmark matches cmark_render_commonmark");
+    INT_EQ(runner, (int)len, (int)strlen(expected), "context cm length");
+    free(expected);
+
+    len = cmark_render_context_latex(ctx, doc, 0, 0);
+    expected = cmark_render_latex(doc, 0, 0);
+    STR_EQ(runner, cmark_render_context_output(ctx), expected,
+           "context latex matches cmark_render_latex");
+    free(expected);
+
+    len = cmark_render_context_man(ctx, doc, 0, 0);
+    expected = cmark_render_man(doc, 0, 0);
+    STR_EQ(runner, cmark_render_context_output(ctx), expected,
+           "context man matches cmark_render_man");
+    free(expected);
+
+    if (i == 0)
+      first = cmark_render_context_output(ctx);
+    cmark_node_free(doc);
+  }
+
+  OK(runner, cmark_render_context_output(ctx) == first,
+     "output buffer is reused across documents");
+
+  cmark_node *para = cmark_node_new(CMARK_NODE_PARAGRAPH);
+  len = cmark_render_context_html(ctx, para, 0);
+  STR_EQ(runner, cmark_render_context_output(ctx), "<p></p>\n",
+         "render a node that is not a document");
+  INT_EQ(runner, (int)len, 8, "length of non-document render");
+  cmark_node_free(para);
+
+  cmark_render_context_free(ctx);
+}
+
+// Text runs are skipped a vector at a time when the CPU allows.  Every
+// byte, at every position in a vector, has to end the run exactly where
+// the byte tables say: rendering with a long prefix must match the short
+// input, which is scanned by the scalar loop.
+static void special_chars(test_batch_runner *runner) {
+  char prefix[80];
+  char input[128];
+  char expected[512];
+  int b, k, smart;
+  bool ok = true;
+
+  memset(prefix, 'x', sizeof(prefix));
+  for (smart = 0; smart < 2; smart++) {
+    int options = smart ? CMARK_OPT_SMART : CMARK_OPT_DEFAULT;
+    for (b = 1; b < 256 && ok; b++) {
+      char *base;
+      sprintf(input, "x %ca%c", b, b);
+      base = cmark_markdown_to_html(input, strlen(input), options);
+      for (k = 1; k < (int)sizeof(prefix) && ok; k++) {
+        char *out;
+        sprintf(input, "%.*sx %ca%c", k, prefix, b, b);
+        sprintf(expected, "<p>%.*s%s", k, prefix, base + 3);
+        out = cmark_markdown_to_html(input, strlen(input), options);
+        if (strcmp(out, expected) != 0) {
+          fprintf(stderr, "byte 0x%02x after %d bytes (smart %d)\n", b, k,
+                  smart);
+          ok = false;
+        }
+        free(out);
+      }
+      free(base);
+    }
+  }
+  OK(runner, ok, "special characters are found at every offset");
+
+  static const struct {
+    const char *markdown;
+    const char *html;
+  } cases[] = {
+      {"*a* _b_ `c` [d](e) ![f](g) <h@i.j> &amp; \\* k\nl\n",
+       "<em>a</em> <em>b</em> <code>c</code> <a href=\"e\">d</a> "
+       "<img src=\"g\" alt=\"f\" /> <a href=\"mailto:h@i.j\">h@i.j</a> "
+       "&amp; * k\nl</p>\n"},
+      {"\"a\" 'b' c... d--\n",
+       "\xe2\x80\x9c" "a\xe2\x80\x9d \xe2\x80\x98" "b\xe2\x80\x99 "
+       "c\xe2\x80\xa6 d\xe2\x80\x93</p>\n"},
+  };
+  size_t i;
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    for (k = 0; k < 40; k++) {
+      char *out;
+      sprintf(input, "%.*s %s", k, prefix, cases[i].markdown);
+      sprintf(expected, "<p>%.*s%s%s", k, prefix, k ? " " : "",
+              cases[i].html);
+      out = cmark_markdown_to_html(input, strlen(input),
+                                   i ? CMARK_OPT_SMART : CMARK_OPT_DEFAULT);
+      if (strcmp(out, expected) != 0) {
+        STR_EQ(runner, out, expected, "inline markup after %d bytes", k);
+        free(out);
+        break;
+      }
+      free(out);
+    }
+    OK(runner, k == 40, "inline markup at every offset");
+  }
+}
+
+// Renders 'tmpl' with its %s replaced by 'run' and its %c by 'b'.
+static char *render_escape_case(const char *tmpl, const char *run, int b,
+                                bool xml) {
+  char input[256];
+  cmark_node *doc;
+  char *out;
+
+  sprintf(input, tmpl, run, b);
+  doc = cmark_parse_document(input, strlen(input), CMARK_OPT_DEFAULT);
+  out = xml ? cmark_render_xml(doc, CMARK_OPT_DEFAULT)
+            : cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  cmark_node_free(doc);
+  return out;
+}
+
+// The escaping functions skip clean bytes a vector at a time when the
+// CPU allows.  For every byte value at every offset, the output for a
+// long run of clean bytes before it has to match the output for a
+// single 'Z', which is short enough to be escaped byte by byte.
+static void escaping(test_batch_runner *runner) {
+  static const struct {
+    const char *tmpl;
+    bool xml;
+  } cases[] = {
+      {"%s%cy\n", false},                  // text
+      {"[a](/%s%cy)\n", false},            // link destination
+      {"[a](</%s%cy>)\n", false},          // with spaces and controls
+      {"[a](/u \"%s%cy\")\n", false},      // link title
+      {"%s%cy\n", true},                   // XML text
+      {"%s\xef\xbf%cy\n", true},           // XML, U+FFFE and U+FFFF
+  };
+  char run[80];
+  char expected[512];
+  size_t i;
+  int b, k;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    bool ok = true;
+    for (b = 1; b < 256 && ok; b++) {
+      char *base = render_escape_case(cases[i].tmpl, "Z", b, cases[i].xml);
+      char *z = strchr(base, 'Z');
+      if (b == 'Z' || z == NULL || strchr(z + 1, 'Z')) {
+        free(base);
+        continue;
+      }
+      for (k = 1; k < (int)sizeof(run) && ok; k++) {
+        char *out;
+        memset(run, 'x', k);
+        run[k] = '\0';
+        out = render_escape_case(cases[i].tmpl, run, b, cases[i].xml);
+        sprintf(expected, "%.*s%s%s", (int)(z - base), base, run, z + 1);
+        if (strcmp(out, expected) != 0) {
+          STR_EQ(runner, out, expected, "escape byte 0x%02x after %d bytes",
+                 b, k);
+          ok = false;
+        }
+        free(out);
+      }
+      free(base);
+    }
+    OK(runner, ok, "escaping case %d at every offset", (int)i);
+  }
+}
+
+static char *render_validated(const char *input, size_t len) {
+  return cmark_markdown_to_html(input, len, CMARK_OPT_VALIDATE_UTF8);
+}
+
+// Valid UTF-8 is skipped a vector at a time.  Every pair of bytes that
+// matter to UTF-8, and longer sequences around each lead byte, must be
+// repaired the same way wherever they fall relative to the vectors as in
+// an input short enough to be checked byte by byte.
+static void utf8_validation(test_batch_runner *runner) {
+  static const int offsets[] = {0, 1, 2, 13, 14, 15, 16, 29, 30, 31, 32, 33};
+  static const unsigned char conts[] = {'a',  0x80, 0x8F, 0x90, 0x9F,
+                                        0xA0, 0xBF, 0xC0, 0xF4};
+  char input[128], expected[512];
+  unsigned char seq[4];
+  size_t nconts = sizeof(conts), seqlen, i, j;
+  int b1, b2, k;
+  bool ok = true;
+
+  for (b1 = 0x7F; b1 < 0x100 && ok; b1++) {
+    for (b2 = 0x7F; b2 < 0x100 + (int)(nconts * nconts) && ok; b2++) {
+      char *base;
+      size_t o;
+      // 'a' stands for ASCII; pairs first, then the lead byte with two
+      // or three of the interesting continuation bytes.
+      seq[0] = b1 == 0x7F ? 'a' : (unsigned char)b1;
+      if (b2 < 0x100) {
+        seq[1] = b2 == 0x7F ? 'a' : (unsigned char)b2;
+        seqlen = 2;
+      } else {
+        if (seq[0] < 0xE0)
+          break;
+        i = (size_t)(b2 - 0x100) / nconts;
+        j = (size_t)(b2 - 0x100) % nconts;
+        seq[1] = conts[i];
+        seq[2] = conts[j];
+        seq[3] = conts[(i + j) % nconts];
+        seqlen = seq[0] < 0xF0 ? 3 : 4;
+      }
+
+      // Text follows, as a cut off sequence at the end of a line is
+      // repaired differently.
+      sprintf(input, "Z%.*syyy\n", (int)seqlen, (const char *)seq);
+      base = render_validated(input, strlen(input));
+      for (o = 0; o < sizeof(offsets) / sizeof(offsets[0]) && ok; o++) {
+        char *out;
+        k = offsets[o];
+        memset(input, 'x', k);
+        sprintf(input + k, "%.*s%s\n", (int)seqlen, (const char *)seq,
+                "yyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyy");
+        sprintf(expected, "<p>%.*s%.*s%s</p>\n", k, input,
+                (int)(strlen(base) - 12), base + 4,
+                "yyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyy");
+        out = render_validated(input, strlen(input));
+        if (strcmp(out, expected) != 0) {
+          STR_EQ(runner, out, expected, "utf8 %02x %02x after %d bytes",
+                 seq[0], seq[1], k);
+          ok = false;
+        }
+        free(out);
+      }
+      free(base);
+    }
+  }
+  OK(runner, ok, "utf8 sequences are repaired at every offset");
+
+  // Lines before and after invalid ones are used in place; the result
+  // must match feeding the same input a byte at a time.
+  static const char doc[] =
+      "valid line with \xc3\xa9 and \xe2\x82\xac and \xf0\x9f\x98\x80\n"
+      "invalid \xc3 here and \xed\xa0\x80 there\n"
+      "> valid quote \xe2\x82\xac \xe2\x82\xac \xe2\x82\xac \xe2\x82\xac\n"
+      "a NUL \0 in the middle of a line\n"
+      "\xff\n"
+      "    code \xe2\x82 cut short\n"
+      "last valid line, long enough for a few vectors of its own\n";
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_VALIDATE_UTF8);
+  cmark_node *fed, *whole;
+  char *fed_html, *whole_html;
+  for (i = 0; i < sizeof(doc) - 1; i++)
+    cmark_parser_feed(parser, doc + i, 1);
+  fed = cmark_parser_finish(parser);
+  cmark_parser_free(parser);
+  whole = cmark_parse_document(doc, sizeof(doc) - 1, CMARK_OPT_VALIDATE_UTF8);
+  fed_html = cmark_render_html(fed, CMARK_OPT_DEFAULT);
+  whole_html = cmark_render_html(whole, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, whole_html, fed_html, "validated in place matches fed");
+  free(fed_html);
+  free(whole_html);
+  cmark_node_free(fed);
+  cmark_node_free(whole);
+}
+
+// Many definitions, with repeats that differ only in case and
+// whitespace: the first definition of each label wins.
+static void reference_map(test_batch_runner *runner) {
+  static const int count = 30000;
+  size_t size = (size_t)count * 64 + 256;
+  char *markdown = (char *)malloc(size);
+  size_t len = 0;
+  char *html;
+  int i;
+
+  len += sprintf(markdown + len, "[Label 7] [label 29999] [nope]\n\n");
+  for (i = 0; i < count; i++)
+    len += sprintf(markdown + len, "[label %d]: /u%d\n", i, i);
+  for (i = 0; i < count; i += 1000)
+    len += sprintf(markdown + len, "[LABEL   %d]: /dup%d\n", i, i);
+
+  html = cmark_markdown_to_html(markdown, len, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html,
+         "<p><a href=\"/u7\">Label 7</a> <a href=\"/u29999\">label 29999</a> "
+         "[nope]</p>\n",
+         "lookup among many references");
+  free(html);
+
+  len = sprintf(markdown, "[label 0]: /first\n[ LABEL\t0 ]: /second\n\n"
+                          "[label 0] [Label  0]\n");
+  html = cmark_markdown_to_html(markdown, len, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html,
+         "<p><a href=\"/first\">label 0</a> "
+         "<a href=\"/first\">Label  0</a></p>\n",
+         "first definition wins");
+  free(html);
+  free(markdown);
+}
+
+static void reference_labels(test_batch_runner *runner) {
+  static const char long_label[] =
+      "A label that is too long to be kept in the lookup cache";
+  static const char unicode[] =
+      "[\xC3\x84" "BC  Def]: /a\n[\xE1\xBA\x9E]: /s\n\n"
+      "[\xC3\xA4" "bc def] [ \xC3\x84" "BC\n\tDEF ] [SS] [ss]\n";
+  char markdown[4096];
+  char expected[4096];
+  char *html;
+  size_t len = 0, exp_len = 0;
+  int i;
+
+  html = cmark_markdown_to_html(unicode, sizeof(unicode) - 1,
+                                CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html,
+         "<p><a href=\"/a\">\xC3\xA4" "bc def</a> "
+         "<a href=\"/a\"> \xC3\x84" "BC\nDEF </a> "
+         "<a href=\"/s\">SS</a> <a href=\"/s\">ss</a></p>\n",
+         "ASCII and non-ASCII labels normalize alike");
+  free(html);
+
+  len += sprintf(markdown + len, "[Foo]: /foo\n[%s]: /long\n\n", long_label);
+  exp_len += sprintf(expected + exp_len, "<p>");
+  for (i = 0; i < 20; i++) {
+    const char *label = i % 3 == 0 ? "FOO" : i % 3 == 1 ? " foo" : "nope";
+    len += sprintf(markdown + len, "[%s] [%s]\n", label, long_label);
+    if (i % 3 == 2)
+      exp_len += sprintf(expected + exp_len, "[%s] ", label);
+    else
+      exp_len += sprintf(expected + exp_len, "<a href=\"/foo\">%s</a> ",
+                         label);
+    exp_len += sprintf(expected + exp_len, "<a href=\"/long\">%s</a>%s",
+                       long_label, i < 19 ? "\n" : "</p>\n");
+  }
+
+  html = cmark_markdown_to_html(markdown, len, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, expected, "repeated labels resolve the same way");
+  free(html);
+}
+
+static void case_folding(test_batch_runner *runner) {
+  static const char markdown[] =
+      "[MixedCASE ascii LABEL \xD0\x9F\xD1\x80\xD0\x98\xD0\x92\xD0\x95\xD0\xA2 "
+      "\xCE\x86\xCE\xBB\xCF\x86\xCE\xB1 Stra\xC3\x9F" "e]: /u\n\n"
+      "[mixedcase ASCII label \xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 "
+      "\xCE\xAC\xCE\x9B\xCE\xA6\xCE\x91 STRASSE]\n";
+  char *html = cmark_markdown_to_html(markdown, sizeof(markdown) - 1,
+                                      CMARK_OPT_DEFAULT);
+
+  STR_EQ(runner, html,
+         "<p><a href=\"/u\">mixedcase ASCII label "
+         "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 "
+         "\xCE\xAC\xCE\x9B\xCE\xA6\xCE\x91 STRASSE</a></p>\n",
+         "labels are case folded");
+  free(html);
+
+  cmark_strbuf buf = {cmark_get_default_mem_allocator(), NULL, 0, 0};
+  unsigned char s[48], expected[48];
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int32_t c;
+  int n, i, k, start, len, mismatches = 0;
+
+  // Every code point, alone and between ASCII letters, folds as it did
+  // with the sorted table before the two-level one.
+  for (c = 0; c < 0x110000; c++) {
+    if (c >= 0xD800 && c < 0xE000)
+      continue;
+    s[0] = 'A';
+    s[1] = 'b';
+    if (c < 0x80) {
+      s[2] = (unsigned char)c;
+      n = 1;
+    } else if (c < 0x800) {
+      s[2] = (unsigned char)(0xC0 | c >> 6);
+      s[3] = (unsigned char)(0x80 | (c & 0x3F));
+      n = 2;
+    } else if (c < 0x10000) {
+      s[2] = (unsigned char)(0xE0 | c >> 12);
+      s[3] = (unsigned char)(0x80 | (c >> 6 & 0x3F));
+      s[4] = (unsigned char)(0x80 | (c & 0x3F));
+      n = 3;
+    } else {
+      s[2] = (unsigned char)(0xF0 | c >> 18);
+      s[3] = (unsigned char)(0x80 | (c >> 12 & 0x3F));
+      s[4] = (unsigned char)(0x80 | (c >> 6 & 0x3F));
+      s[5] = (unsigned char)(0x80 | (c & 0x3F));
+      n = 4;
+    }
+    s[n + 2] = 'C';
+    s[n + 3] = 'd';
+    for (k = 0; k < 2; k++) {
+      buf.size = 0;
+      if (k == 0)
+        cmark_utf8proc_case_fold(&buf, s + 2, n);
+      else
+        cmark_utf8proc_case_fold(&buf, s, n + 4);
+      for (i = 0; i < buf.size; i++) {
+        hash ^= buf.ptr[i];
+        hash *= 0x100000001b3ULL;
+      }
+      hash ^= 0xFF;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+  OK(runner, hash == 0xfcaa63d18194a1f5ULL,
+     "every code point folds as before (hash %016llx)",
+     (unsigned long long)hash);
+
+  // Runs of ASCII are folded eight bytes at a time; the bytes next to
+  // the letters must stay as they are, wherever the runs start and end,
+  // also next to a two-byte character.
+  static const char *const pieces[] = {"@", "A", "M", "Z", "[",
+                                       "`", "a", "z", "{", "\xC3\x89"};
+  for (k = 0; k < 10; k++) {
+    for (n = 0, i = 0; n < 40; i++) {
+      const char *piece = pieces[(i * 7 + k) % 10];
+      size_t piece_len = strlen(piece);
+      memcpy(s + n, piece, piece_len);
+      if (piece_len == 2) {
+        expected[n] = 0xC3;
+        expected[n + 1] = 0xA9;
+      } else {
+        expected[n] = s[n] >= 'A' && s[n] <= 'Z' ? s[n] + 32 : s[n];
+      }
+      n += (int)piece_len;
+    }
+    for (start = 0; start < 8; start++) {
+      for (len = 0; start + len <= 32; len++) {
+        if ((s[start] & 0xC0) == 0x80 ||
+            (start + len < n && (s[start + len] & 0xC0) == 0x80))
+          continue;
+        buf.size = 0;
+        cmark_utf8proc_case_fold(&buf, s + start, len);
+        if (buf.size != len || memcmp(buf.ptr, expected + start, len))
+          mismatches++;
+      }
+    }
+  }
+  INT_EQ(runner, mismatches, 0, "ASCII runs fold at every alignment");
+  cmark_get_default_mem_allocator()->free(buf.ptr);
+}
+
+static void unicode_flanking(test_batch_runner *runner) {
+  static const char markdown[] =
+      "*\xE3\x80\x8C" "b\xE3\x80\x8D*\n\n"
+      "a*\xE3\x80\x8C" "b\xE3\x80\x8D*c\n\n"
+      "\xF0\x9F\x98\x80**x**\xF0\x9F\x98\x80\n\n"
+      "a**\xF0\x9F\x98\x80**b\n\n"
+      "\xE3\x80\x80*x*\xE3\x80\x80\n\n"
+      "_\xC2\xA0y_\n\n"
+      "\xE2\x82\xAC_z_\xE2\x82\xAC\n";
+  char *html = cmark_markdown_to_html(markdown, sizeof(markdown) - 1,
+                                      CMARK_OPT_DEFAULT);
+
+  STR_EQ(runner, html,
+         "<p><em>\xE3\x80\x8C" "b\xE3\x80\x8D</em></p>\n"
+         "<p>a*\xE3\x80\x8C" "b\xE3\x80\x8D*c</p>\n"
+         "<p>\xF0\x9F\x98\x80<strong>x</strong>\xF0\x9F\x98\x80</p>\n"
+         "<p>a**\xF0\x9F\x98\x80**b</p>\n"
+         "<p>\xE3\x80\x80<em>x</em>\xE3\x80\x80</p>\n"
+         "<p>_\xC2\xA0y_</p>\n"
+         "<p>\xE2\x82\xAC<em>z</em>\xE2\x82\xAC</p>\n",
+         "delimiters next to non-ASCII punctuation, symbols and spaces");
+  free(html);
+}
+
+static void structural_index(test_batch_runner *runner) {
+  static const char *const pieces[] = {
+      "*a*", "`b`", "[c](/d)", "\\*", "&amp;", "<e>", "!", "_f_", "\r\n",
+      "\n", "\r", "\n\n", "> ", "- ", "    ", "x", "\0",
+  };
+  size_t n = sizeof(pieces) / sizeof(*pieces);
+  char markdown[2048];
+  size_t len, i, shift;
+
+  // Shifting the same pieces by one byte at a time puts line endings and
+  // special characters on either side of each 64-byte word of the index.
+  for (shift = 0; shift < 64; shift += 3) {
+    cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+    cmark_node *doc;
+    char *expected, *html;
+
+    memset(markdown, 'y', shift);
+    len = shift;
+    for (i = 0; len + 8 < sizeof(markdown); i++) {
+      size_t plen = strlen(pieces[i % n]);
+      if (i % n == n - 1)
+        plen = 1; // the NUL
+      memcpy(markdown + len, pieces[i % n], plen);
+      len += plen;
+    }
+
+    cmark_parser_feed(parser, markdown, len);
+    doc = cmark_parser_finish(parser);
+    expected = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+    cmark_node_free(doc);
+    cmark_parser_free(parser);
+
+    doc = cmark_parse_document(markdown, len, CMARK_OPT_DEFAULT);
+    html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+    STR_EQ(runner, html, expected, "indexed parse matches streaming parse");
+    free(html);
+    free(expected);
+    cmark_node_free(doc);
+  }
+
+  // Bit positions near the end of the largest input the index takes.
+  // The pages of the bitmap that aren't touched are never mapped.
+  bufsize_t end = INT32_MAX;
+  uint64_t *bits = (uint64_t *)calloc(((size_t)end + 63) / 64, 8);
+  if (bits) {
+    INT_EQ(runner, cmark_structural_next(bits, end - 10, end), end,
+           "no set bit before INT32_MAX");
+    bits[(end - 3) / 64] |= (uint64_t)1 << ((end - 3) % 64);
+    INT_EQ(runner, cmark_structural_next(bits, end - 10, end), end - 3,
+           "set bit just before INT32_MAX");
+    INT_EQ(runner, cmark_structural_next(bits, end - 2, end), end,
+           "set bit before the start isn't found");
+    free(bits);
+  }
+}
+
+static void parallel_parse(test_batch_runner *runner) {
+  static const char *const blocks[] = {
+      "[ref]: /url \"title\"\n\n",
+      "Some *emphasis* and **strong** text with `code`, [ref] and\n"
+      "[a link](/dest) that goes on for a while.\n\n",
+      "# Heading with _emphasis_ and [ref][]\n\n",
+      "- item with <http://auto.link> and &amp; entities\n"
+      "- item with ![image](/img.png) and [undefined]\n\n",
+      "> quoted \"smart\" text -- with dashes...\n\n",
+  };
+  int options[] = {CMARK_OPT_DEFAULT | CMARK_OPT_SOURCEPOS,
+                   CMARK_OPT_SMART | CMARK_OPT_BORROW_INPUT |
+                       CMARK_OPT_SOURCEPOS};
+  size_t nblocks = sizeof(blocks) / sizeof(*blocks);
+  size_t cap = 256 * 1024, len = 0, i;
+  char *markdown = (char *)malloc(cap);
+  char *url = (char *)malloc(8192);
+  char *expected, *xml;
+  cmark_node *doc;
+
+  for (i = 0; len + 256 < cap; i++) {
+    size_t n = strlen(blocks[i % nblocks]);
+    memcpy(markdown + len, blocks[i % nblocks], n);
+    len += n;
+  }
+
+  for (i = 0; i < sizeof(options) / sizeof(*options); i++) {
+    doc = cmark_parse_document(markdown, len, options[i]);
+    expected = cmark_render_xml(doc, options[i]);
+    cmark_node_free(doc);
+
+    doc = cmark_parse_document_parallel(markdown, len, options[i], 4);
+    xml = cmark_render_xml(doc, options[i]);
+    STR_EQ(runner, xml, expected, "parallel parse gives the same tree");
+    free(xml);
+    cmark_node_free(doc);
+
+    doc = cmark_parse_document_parallel(markdown, len, options[i], 0);
+    xml = cmark_render_xml(doc, options[i]);
+    STR_EQ(runner, xml, expected, "parallel parse with one thread per CPU");
+    free(xml);
+    cmark_node_free(doc);
+    free(expected);
+  }
+
+  // References that would expand the document past the limit stop
+  // expanding at the same place as in a serial parse.
+  len = 0;
+  memcpy(markdown, "[big]: /", 8);
+  len = 8;
+  memset(url, 'u', 8000);
+  memcpy(markdown + len, url, 8000);
+  len += 8000;
+  markdown[len++] = '\n';
+  while (len + 16 < cap) {
+    memcpy(markdown + len, "\n[big] *x*\n", 11);
+    len += 11;
+  }
+  doc = cmark_parse_document(markdown, len, CMARK_OPT_DEFAULT);
+  expected = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  cmark_node_free(doc);
+  doc = cmark_parse_document_parallel(markdown, len, CMARK_OPT_DEFAULT, 4);
+  xml = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+  STR_EQ(runner, xml, expected, "expansion limit applies in document order");
+  free(xml);
+  free(expected);
+  cmark_node_free(doc);
+
+  free(url);
+  free(markdown);
+}
+
+static void parallel_blocks(test_batch_runner *runner) {
+  // Large enough to be split into pieces.  Labels are used before and
+  // defined after, and again with other destinations, in other pieces.
+  // A loose list and a fence with blank lines inside are long enough to
+  // cross a piece boundary and force a piece to be parsed again.
+  size_t cap = 5 * 1024 * 1024, len = 0, i;
+  char *markdown = (char *)malloc(cap);
+  char *expected, *xml;
+  cmark_node *doc;
+  int options = CMARK_OPT_SOURCEPOS;
+
+  for (i = 0; len + 64 < cap / 2; i++)
+    len += sprintf(markdown + len, "See [r%d] and *more*.\n\n", (int)(i % 500));
+  for (i = 0; len + 64 < cap / 2 + 300000; i++)
+    len += sprintf(markdown + len, "- item %d\n\n  more\n\n", (int)i);
+  len += sprintf(markdown + len, "```\n");
+  for (i = 0; len + 64 < cap / 2 + 600000; i++)
+    len += sprintf(markdown + len, "code\n\nline\n");
+  len += sprintf(markdown + len, "```\n\n");
+  for (i = 0; len + 64 < cap; i++)
+    len += sprintf(markdown + len, "[r%d]: /%d\n\n", (int)(i % 1000), (int)i);
+
+  doc = cmark_parse_document(markdown, len, options);
+  expected = cmark_render_xml(doc, options);
+  cmark_node_free(doc);
+
+  doc = cmark_parse_document_parallel(markdown, len, options, 4);
+  xml = cmark_render_xml(doc, options);
+  STR_EQ(runner, xml, expected, "blocks parsed in pieces give the same tree");
+  free(xml);
+  cmark_node_free(doc);
+
+  free(expected);
+  free(markdown);
+}
+
+static void parallel_render(test_batch_runner *runner) {
+  static const char *const blocks[] = {
+      "# Heading *one*\n\n",
+      "Paragraph with ![alt *text*](/img \"t\") and <span>html</span>\n"
+      "over two lines.\n\n",
+      "- tight\n- list\n\n",
+      "1. loose\n\n2. list\n\n",
+      "> quote\n\n",
+      "```c\ncode & <stuff>\n```\n\n",
+      "<div>\nraw\n</div>\n\n",
+      "***\n\n",
+  };
+  int options[] = {CMARK_OPT_DEFAULT, CMARK_OPT_SOURCEPOS | CMARK_OPT_UNSAFE,
+                   CMARK_OPT_HARDBREAKS};
+  size_t nblocks = sizeof(blocks) / sizeof(*blocks);
+  size_t cap = 512 * 1024, len = 0, i;
+  char *markdown = (char *)malloc(cap);
+  char *expected, *html;
+  cmark_node *doc;
+
+  for (i = 0; len + 256 < cap; i++) {
+    size_t n = strlen(blocks[i % nblocks]);
+    memcpy(markdown + len, blocks[i % nblocks], n);
+    len += n;
+  }
+  doc = cmark_parse_document(markdown, len, CMARK_OPT_DEFAULT);
+
+  for (i = 0; i < sizeof(options) / sizeof(*options); i++) {
+    expected = cmark_render_html(doc, options[i]);
+    html = cmark_render_html_parallel(doc, options[i], 4);
+    STR_EQ(runner, html, expected, "parallel render gives the same HTML");
+    free(html);
+    free(expected);
+  }
+
+  cmark_node_free(doc);
+  free(markdown);
+}
+
+static void batch_convert(test_batch_runner *runner) {
+  static const char *const markdown[] = {
+      "# Title\n\n[link] and *emphasis*\n\n[link]: /url \"t\"\n",
+      "",
+      "- a\n- b\n\n      code\n",
+      "> quote with [link]\n",
+      "<div>\nraw\n</div>\n\n\"Smart\" quotes -- and dashes...\n",
+  };
+  size_t n = sizeof(markdown) / sizeof(*markdown);
+  cmark_doc_in docs[40];
+  cmark_doc_out out[40];
+  cmark_batch_opts opts = {CMARK_OPT_SMART | CMARK_OPT_SOURCEPOS, 3};
+  size_t i;
+  char *expected;
+  int used, mismatches = 0;
+
+  for (i = 0; i < 40; i++) {
+    docs[i].text = markdown[i % n];
+    docs[i].len = strlen(markdown[i % n]);
+  }
+
+  used = cmark_markdown_to_html_batch(docs, 40, out, &opts);
+  OK(runner, used >= 1 && used <= 3, "batch uses at most nthreads threads");
+  for (i = 0; i < 40; i++) {
+    expected = cmark_markdown_to_html(docs[i].text, docs[i].len, opts.options);
+    if (strcmp(out[i].html, expected) || out[i].len != strlen(expected) ||
+        out[i].seconds < 0)
+      mismatches++;
+    free(expected);
+    free(out[i].html);
+  }
+  INT_EQ(runner, mismatches, 0, "batch converts each document alone");
+
+  cmark_markdown_to_html_batch(docs, 1, out, NULL);
+  STR_EQ(runner, out[0].html,
+         "<h1>Title</h1>\n<p><a href=\"/url\" title=\"t\">link</a> and "
+         "<em>emphasis</em></p>\n",
+         "batch uses the default options without opts");
+  free(out[0].html);
+
+  INT_EQ(runner, cmark_markdown_to_html_batch(docs, 0, out, NULL), 0,
+         "batch of no documents");
+}
+
+// Replaces 'old_len' bytes of 'text' at 'start' with 'ins', reparses and
+// compares the result with a full parse of the new text.
+static cmark_node *reparse_edit(test_batch_runner *runner,
+                                cmark_parser *parser, cmark_node *document,
+                                char *text, size_t start, size_t old_len,
+                                const char *ins, const char *msg) {
+  size_t len = strlen(text), ins_len = strlen(ins);
+  cmark_node *full;
+  char *xml, *expected;
+
+  memmove(text + start + ins_len, text + start + old_len,
+          len - start - old_len + 1);
+  memcpy(text + start, ins, ins_len);
+  len = len - old_len + ins_len;
+  document = cmark_parser_reparse(parser, document, text, len, start,
+                                  start + old_len, start + ins_len);
+  full = cmark_parse_document(text, len, CMARK_OPT_SOURCEPOS);
+  xml = cmark_render_xml(document, CMARK_OPT_SOURCEPOS);
+  expected = cmark_render_xml(full, CMARK_OPT_SOURCEPOS);
+  STR_EQ(runner, xml, expected, "%s", msg);
+  free(xml);
+  free(expected);
+  cmark_node_free(full);
+  return document;
+}
+
+static void incremental_reparse(test_batch_runner *runner) {
+  char text[256] = "# Title\n\n[link] in a paragraph\n\nsome *text*\n\n"
+                   "> a quote\n> with two lines\n\n- a\n- b\n";
+  cmark_parser *parser = cmark_parser_new(CMARK_OPT_SOURCEPOS);
+  cmark_node *document, *heading, *list;
+  char *html, *expected;
+
+  cmark_parser_feed(parser, text, strlen(text));
+  document = cmark_parser_finish(parser);
+  heading = cmark_node_first_child(document);
+  list = cmark_node_last_child(document);
+
+  document = reparse_edit(runner, parser, document, text, 38, 4, "words",
+                          "reparse an edit within a paragraph");
+  OK(runner, cmark_node_first_child(document) == heading &&
+                 cmark_node_last_child(document) == list,
+     "reparse keeps the blocks the edit doesn't touch");
+
+  cmark_parser *region = parser->reparse;
+  document = reparse_edit(runner, parser, document, text, 9, 0,
+                          "new\nlines\n\n",
+                          "reparse shifts the blocks after added lines");
+  OK(runner, region && parser->reparse == region,
+     "reparse keeps its region parser");
+  OK(runner, cmark_node_last_child(document) == list,
+     "reparse keeps shifted blocks");
+  INT_EQ(runner, cmark_node_get_start_line(list), 13,
+         "reparse adjusts the lines of shifted blocks");
+
+  document = reparse_edit(runner, parser, document, text, strlen(text), 0,
+                          "\n[link]: /url\n",
+                          "reparse a new reference definition");
+  html = cmark_render_html(document, CMARK_OPT_DEFAULT);
+  OK(runner, strstr(html, "<a href=\"/url\">link</a>") != NULL,
+     "reparse resolves links above a new definition");
+  free(html);
+
+  document = reparse_edit(runner, parser, document, text, 12, 1, "",
+                          "reparse joins two lines");
+  document = reparse_edit(runner, parser, document, text, strlen(text) - 14,
+                          14, "", "reparse a removed reference definition");
+  html = cmark_render_html(document, CMARK_OPT_DEFAULT);
+  OK(runner, strstr(html, "<a href") == NULL,
+     "reparse drops links to a removed definition");
+  free(html);
+
+  document = reparse_edit(runner, parser, document, text, 0, 0, "* ",
+                          "reparse an edit that changes every block");
+  cmark_node_free(document);
+
+  document = cmark_parser_reparse(parser, NULL, text, strlen(text), 0, 0, 0);
+  html = cmark_render_html(document, CMARK_OPT_DEFAULT);
+  expected = cmark_markdown_to_html(text, strlen(text), CMARK_OPT_DEFAULT);
+  STR_EQ(runner, html, expected,
+         "reparse without a document parses everything");
+  free(html);
+  free(expected);
+  cmark_node_free(document);
+  cmark_parser_free(parser);
+}
+
 int main(void) {
   int retval;
   test_batch_runner *runner = test_batch_runner_new();
@@ -1185,6 +2546,29 @@ int main(void) {
   source_pos(runner);
   source_pos_inlines(runner);
   ref_source_pos(runner);
+  parser_reset(runner);
+  compact_tree(runner);
+  node_pool(runner);
+  borrow_input(runner);
+  in_place_input(runner);
+  short_literals(runner);
+  arena_allocator(runner);
+  counting_allocator(runner);
+  memory_limit(runner);
+  render_context(runner);
+  special_chars(runner);
+  escaping(runner);
+  utf8_validation(runner);
+  reference_map(runner);
+  reference_labels(runner);
+  case_folding(runner);
+  unicode_flanking(runner);
+  structural_index(runner);
+  parallel_parse(runner);
+  parallel_blocks(runner);
+  parallel_render(runner);
+  batch_convert(runner);
+  incremental_reparse(runner);
 
   test_print_summary(runner);
   retval = test_ok(runner) ? 0 : 1;
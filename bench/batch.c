@@ -0,0 +1,110 @@
+// Measures how fast a set of documents is converted to HTML one by one
+// with cmark_markdown_to_html and all at once with
+// cmark_markdown_to_html_batch, on one thread and on all processors.
+// The files named on the command line are each converted REPEAT times.
+// See `make batchbench`.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmark.h"
+
+#define REPEAT 1000
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  char *text;
+  long size;
+
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  rewind(f);
+  text = (char *)malloc(size > 0 ? (size_t)size : 1);
+  *len = fread(text, 1, (size_t)size, f);
+  fclose(f);
+  return text;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *s, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void report(const char *name, double secs, size_t ndocs, size_t bytes,
+                   uint64_t hash) {
+  printf("%-14s %9.0f docs/s %8.1f MB/s  checksum %016llx\n", name,
+         (double)ndocs / secs, (double)bytes / secs / 1e6,
+         (unsigned long long)hash);
+}
+
+int main(int argc, char **argv) {
+  size_t nfiles = (size_t)(argc - 1), ndocs = nfiles * REPEAT;
+  cmark_doc_in *docs = (cmark_doc_in *)calloc(ndocs, sizeof(cmark_doc_in));
+  cmark_doc_out *out = (cmark_doc_out *)calloc(ndocs, sizeof(cmark_doc_out));
+  size_t bytes = 0, i;
+  int threads;
+
+  if (nfiles == 0) {
+    fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+    return 1;
+  }
+  for (i = 0; i < nfiles; i++)
+    docs[i].text = read_file(argv[i + 1], &docs[i].len);
+  for (i = nfiles; i < ndocs; i++)
+    docs[i] = docs[i % nfiles];
+  for (i = 0; i < ndocs; i++)
+    bytes += docs[i].len;
+
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    double start = now();
+
+    for (i = 0; i < ndocs; i++) {
+      char *html =
+          cmark_markdown_to_html(docs[i].text, docs[i].len, CMARK_OPT_DEFAULT);
+      hash = fnv1a(hash, html, strlen(html));
+      free(html);
+    }
+    report("one by one", now() - start, ndocs, bytes, hash);
+  }
+
+  for (threads = 1; threads >= 0; threads--) {
+    cmark_batch_opts opts = {CMARK_OPT_DEFAULT, threads};
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    double start = now(), secs;
+    char name[32];
+    int used;
+
+    used = cmark_markdown_to_html_batch(docs, ndocs, out, &opts);
+    secs = now() - start;
+    for (i = 0; i < ndocs; i++) {
+      hash = fnv1a(hash, out[i].html, out[i].len);
+      free(out[i].html);
+    }
+    snprintf(name, sizeof(name), "batch, %d thr", used);
+    report(name, secs, ndocs, bytes, hash);
+  }
+
+  for (i = 0; i < nfiles; i++)
+    free((char *)docs[i].text);
+  free(docs);
+  free(out);
+  return 0;
+}
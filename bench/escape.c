@@ -0,0 +1,96 @@
+// Measures how fast the HTML and XML renderers escape text, in bytes of
+// source per second, and prints a checksum of each output so that
+// builds with and without vector kernels can be compared.  See
+// `make escapebench`.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmark.h"
+
+#define DOC_SIZE (1 << 20)
+#define RUNS 20
+
+static const char PROSE[] =
+    "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+    "eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim "
+    "ad minim veniam, quis nostrud exercitation ullamco & laboris nisi.\n";
+
+static const char MARKUP[] =
+    "<div class=\"note\"><a href=\"/x?a=1&b=2\">it's</a> <b>x</b> "
+    "&lt;</div>\n";
+
+static const char URL[] =
+    "[link](https://example.com/some/long/path/to/a/page?query=value&"
+    "other=some%20thing#frag \"title with <markup> & 'quotes'\")\n\n";
+
+// Repeats 'text' into a document of about DOC_SIZE bytes, as a fenced
+// code block unless 'fence' is false.
+static char *make_doc(const char *text, int fence, size_t *len) {
+  size_t n = strlen(text);
+  char *doc = (char *)malloc(DOC_SIZE + n + 16);
+  size_t pos = 0;
+
+  if (fence) {
+    memcpy(doc, "```\n", 4);
+    pos = 4;
+  }
+  while (pos < DOC_SIZE) {
+    memcpy(doc + pos, text, n);
+    pos += n;
+  }
+  if (fence) {
+    memcpy(doc + pos, "```\n", 4);
+    pos += 4;
+  }
+  doc[pos] = '\0';
+  *len = pos;
+  return doc;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *s, size_t len) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void bench(const char *name, const char *text, int fence) {
+  size_t len, out_len = 0;
+  char *source = make_doc(text, fence, &len);
+  cmark_node *doc = cmark_parse_document(source, len, CMARK_OPT_DEFAULT);
+  cmark_render_context *ctx = cmark_render_context_new(NULL);
+  int xml, i;
+
+  for (xml = 0; xml < 2; xml++) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    clock_t start = clock();
+    double secs;
+
+    for (i = 0; i < RUNS; i++) {
+      out_len = xml ? cmark_render_context_xml(ctx, doc, CMARK_OPT_DEFAULT)
+                    : cmark_render_context_html(ctx, doc, CMARK_OPT_DEFAULT);
+    }
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    hash = fnv1a(hash, cmark_render_context_output(ctx), out_len);
+    printf("%-8s %-4s %9.1f MB/s  checksum %016llx\n", name,
+           xml ? "xml" : "html", (double)len * RUNS / secs / 1e6,
+           (unsigned long long)hash);
+  }
+
+  cmark_render_context_free(ctx);
+  cmark_node_free(doc);
+  free(source);
+}
+
+int main(void) {
+  bench("prose", PROSE, 1);
+  bench("markup", MARKUP, 1);
+  bench("links", URL, 0);
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmark.h"
+#include "thread.h"
+
+/* A bump allocator for documents that are parsed, rendered and thrown
+ * away as a whole.  Every allocation is carved out of a large chunk and
+ * 'free' does nothing; 'cmark_arena_reset' releases everything at once.
+ *
+ * cmark_mem callbacks carry no context pointer, so the arena is kept per
+ * thread: each thread that uses the arena allocator gets its own chunks.
+ */
+
+#define ARENA_CHUNK_SIZE (4 * 1024 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+  struct arena_chunk *prev;
+  size_t size;
+  size_t used;
+  size_t last; // offset of the most recent allocation's header
+} arena_chunk;
+
+// Each allocation is preceded by its usable size so that realloc
+// knows how much to copy.  The padding keeps payloads 16-byte aligned.
+typedef struct {
+  size_t size;
+  size_t pad;
+} arena_header;
+
+// The newest chunk of the calling thread's arena.
+static CMARK_THREAD_LOCAL arena_chunk *thread_arena = NULL;
+
+#define CHUNK_DATA(c) ((unsigned char *)(c) + sizeof(arena_chunk))
+
+static size_t S_round_up(size_t sz) {
+  return (sz + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void S_out_of_memory(void) {
+  fprintf(stderr, "[cmark] arena allocation failed, aborting\n");
+  abort();
+}
+
+static arena_chunk *S_new_chunk(size_t size, arena_chunk *prev) {
+  arena_chunk *c = (arena_chunk *)malloc(sizeof(arena_chunk) + size);
+  if (!c)
+    S_out_of_memory();
+  c->prev = prev;
+  c->size = size;
+  c->used = 0;
+  c->last = SIZE_MAX;
+  return c;
+}
+
+// Returns a pointer to 'size' usable bytes (not zeroed).
+static void *S_arena_alloc(size_t size) {
+  size_t need;
+  arena_header *hdr;
+
+  if (size > SIZE_MAX - sizeof(arena_header) - ARENA_ALIGN)
+    S_out_of_memory();
+  need = S_round_up(sizeof(arena_header) + size);
+
+  if (thread_arena == NULL) {
+    thread_arena =
+        S_new_chunk(need > ARENA_CHUNK_SIZE ? need : ARENA_CHUNK_SIZE, NULL);
+  } else if (need > thread_arena->size - thread_arena->used) {
+    size_t next = thread_arena->size + thread_arena->size / 2;
+    thread_arena = S_new_chunk(need > next ? need : next, thread_arena);
+  }
+
+  hdr = (arena_header *)(CHUNK_DATA(thread_arena) + thread_arena->used);
+  hdr->size = need - sizeof(arena_header);
+  thread_arena->last = thread_arena->used;
+  thread_arena->used += need;
+  return hdr + 1;
+}
+
+static void *arena_calloc(size_t nmem, size_t size) {
+  void *ptr;
+  if (size && nmem > SIZE_MAX / size)
+    S_out_of_memory();
+  ptr = S_arena_alloc(nmem * size);
+  memset(ptr, 0, nmem * size);
+  return ptr;
+}
+
+static void *arena_realloc(void *ptr, size_t size) {
+  arena_header *hdr;
+  void *new_ptr;
+
+  if (ptr == NULL)
+    return S_arena_alloc(size);
+
+  hdr = (arena_header *)ptr - 1;
+  if (size <= hdr->size)
+    return ptr;
+
+  // Growing the most recent allocation (the common case for a
+  // cmark_strbuf being appended to) can be done in place.
+  if (thread_arena &&
+      (unsigned char *)hdr == CHUNK_DATA(thread_arena) + thread_arena->last &&
+      size <= SIZE_MAX - ARENA_ALIGN) {
+    size_t need = S_round_up(size);
+    if (need - hdr->size <= thread_arena->size - thread_arena->used) {
+      thread_arena->used += need - hdr->size;
+      hdr->size = need;
+      return ptr;
+    }
+  }
+
+  new_ptr = S_arena_alloc(size);
+  memcpy(new_ptr, ptr, hdr->size);
+  return new_ptr;
+}
+
+static void arena_free(void *ptr) { (void)ptr; }
+
+static cmark_mem CMARK_ARENA_MEM_ALLOCATOR = {arena_calloc, arena_realloc,
+                                              arena_free};
+
+cmark_mem *cmark_get_arena_mem_allocator(void) {
+  return &CMARK_ARENA_MEM_ALLOCATOR;
+}
+
+void cmark_arena_reset(void) {
+  arena_chunk *keep = NULL;
+
+  // Keep one chunk of the standard size around for the next document
+  // and release the others, so that one large document doesn't leave
+  // its peak memory pinned to the thread.
+  while (thread_arena) {
+    arena_chunk *prev = thread_arena->prev;
+    if (keep == NULL && thread_arena->size == ARENA_CHUNK_SIZE)
+      keep = thread_arena;
+    else
+      free(thread_arena);
+    thread_arena = prev;
+  }
+
+  if (keep) {
+    keep->prev = NULL;
+    keep->used = 0;
+    keep->last = SIZE_MAX;
+  }
+  thread_arena = keep;
+}
+
+void cmark_arena_release(void) {
+  while (thread_arena) {
+    arena_chunk *prev = thread_arena->prev;
+    free(thread_arena);
+    thread_arena = prev;
+  }
+}
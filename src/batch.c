@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmark.h"
+#include "parser.h"
+#include "thread.h"
+
+/* Converts many documents at once.  Each worker keeps one parser, whose
+ * node pool recycles the nodes of one document for the next, and one
+ * render context, whose buffer keeps the size of the largest output so
+ * far, so the only allocations left per document are for growing those
+ * and for the string handed back.
+ */
+
+typedef struct {
+  cmark_parser *parser;
+  cmark_render_context *render;
+} batch_worker;
+
+typedef struct {
+  size_t len;
+  size_t index;
+} batch_doc;
+
+typedef struct {
+  const cmark_doc_in *docs;
+  cmark_doc_out *out;
+  batch_doc *order;
+  int options;
+  batch_worker *workers;
+} batch_job;
+
+static double S_now(void) {
+  struct timespec ts;
+
+  if (!timespec_get(&ts, TIME_UTC))
+    return 0;
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void S_convert_task(void *ctx, size_t task, int worker) {
+  batch_job *job = (batch_job *)ctx;
+  batch_worker *w = &job->workers[worker];
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  size_t i = job->order[task].index;
+  const cmark_doc_in *in = &job->docs[i];
+  cmark_doc_out *out = &job->out[i];
+  double start = S_now();
+  cmark_node *document;
+
+  if (!w->parser) {
+    w->parser = cmark_parser_new(job->options);
+    w->render = cmark_render_context_new(NULL);
+  }
+
+  document = cmark_parser_parse_buffer(w->parser, in->text, in->len,
+                                       job->options);
+  out->len = cmark_render_context_html(w->render, document, job->options);
+  out->html = (char *)mem->calloc(out->len + 1, 1);
+  memcpy(out->html, cmark_render_context_output(w->render), out->len);
+  cmark_node_free(document);
+  out->seconds = S_now() - start;
+}
+
+// Hands out the largest documents first, so that the last ones to be
+// taken are small and the workers finish at about the same time.
+static int S_compare_docs(const void *a, const void *b) {
+  const batch_doc *da = (const batch_doc *)a;
+  const batch_doc *db = (const batch_doc *)b;
+
+  if (da->len != db->len)
+    return da->len < db->len ? 1 : -1;
+  return da->index < db->index ? -1 : da->index > db->index;
+}
+
+int cmark_markdown_to_html_batch(const cmark_doc_in *docs, size_t n,
+                                 cmark_doc_out *out,
+                                 const cmark_batch_opts *opts) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  int options = opts ? opts->options : CMARK_OPT_DEFAULT;
+  int nthreads = opts ? opts->nthreads : 0;
+  batch_job job;
+  size_t i;
+  int used;
+
+  if (n == 0)
+    return 0;
+  if (nthreads <= 0)
+    nthreads = cmark_thread_count();
+  if ((size_t)nthreads > n)
+    nthreads = (int)n;
+
+  job.docs = docs;
+  job.out = out;
+  job.options = options;
+  job.order = (batch_doc *)mem->calloc(n, sizeof(batch_doc));
+  job.workers = (batch_worker *)mem->calloc(nthreads, sizeof(batch_worker));
+  for (i = 0; i < n; i++) {
+    job.order[i].len = docs[i].len;
+    job.order[i].index = i;
+  }
+  qsort(job.order, n, sizeof(batch_doc), S_compare_docs);
+
+  used = cmark_run_tasks(S_convert_task, &job, n, nthreads);
+
+  for (i = 0; i < (size_t)nthreads; i++) {
+    if (job.workers[i].parser) {
+      cmark_parser_free(job.workers[i].parser);
+      cmark_render_context_free(job.workers[i].render);
+    }
+  }
+  mem->free(job.workers);
+  mem->free(job.order);
+  return used;
+}
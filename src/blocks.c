@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -22,6 +23,7 @@
 #include "houdini.h"
 #include "buffer.h"
 #include "chunk.h"
+#include "thread.h"
 
 #define CODE_INDENT 4
 #define TAB_STOP 4
@@ -32,6 +34,41 @@
 
 #define peek_at(i, n) (i)->data[n]
 
+// Rough number of input bytes per node of the resulting tree, used to
+// size the parser's node pool.  Prose such as spec.txt has about 30;
+// markup-heavy input has fewer, and the pool grows as needed.
+#define BYTES_PER_NODE 32
+
+// Block starts that a line may open, by the byte at its first nonspace.
+// Every other byte, and in particular the letters most paragraph lines
+// begin with, can only start a paragraph or continue one.
+#define BLOCK_START_QUOTE 0x01
+#define BLOCK_START_ATX 0x02
+#define BLOCK_START_FENCE 0x04
+#define BLOCK_START_HTML 0x08
+#define BLOCK_START_SETEXT 0x10
+#define BLOCK_START_BREAK 0x20
+#define BLOCK_START_LIST 0x40
+
+// Bytes from 0x80 up start nothing and are left zero.
+static const uint8_t S_block_starts[256] = {
+    /* 00 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 08 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 10 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 18 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 20 */ 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    /* 28 */ 0x00, 0x00, 0x60, 0x40, 0x00, 0x70, 0x00, 0x00,
+    /* 30 */ 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40,
+    /* 38 */ 0x40, 0x40, 0x00, 0x00, 0x08, 0x10, 0x01, 0x00,
+    /* 40 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 48 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 50 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 58 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20,
+    /* 60 */ 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 68 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 70 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* 78 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00};
+
 static bool S_last_line_blank(const cmark_node *node) {
   return (node->flags & CMARK_NODE__LAST_LINE_BLANK) != 0;
 }
@@ -69,14 +106,19 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
 static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
                            bufsize_t bytes);
 
-static cmark_node *make_block(cmark_mem *mem, cmark_node_type tag,
-                              int start_line, int start_column) {
+static cmark_node *make_block(cmark_mem *mem, cmark_node_pool *pool,
+                              cmark_node_type tag, int start_line,
+                              int start_column) {
   cmark_node *e;
 
-  e = (cmark_node *)mem->calloc(1, sizeof(*e));
-  e->mem = mem;
+  if (pool) {
+    e = cmark_node_pool_alloc(pool, mem);
+  } else {
+    e = (cmark_node *)mem->calloc(1, sizeof(*e));
+    e->mem = mem;
+  }
   e->type = (uint16_t)tag;
-  e->flags = CMARK_NODE__OPEN;
+  e->flags |= CMARK_NODE__OPEN;
   e->start_line = start_line;
   e->start_column = start_column;
   e->end_line = start_line;
@@ -86,21 +128,27 @@ static cmark_node *make_block(cmark_mem *mem, cmark_node_type tag,
 
 // Create a root document node.
 static cmark_node *make_document(cmark_mem *mem) {
-  cmark_node *e = make_block(mem, CMARK_NODE_DOCUMENT, 1, 1);
+  cmark_node *e = make_block(mem, NULL, CMARK_NODE_DOCUMENT, 1, 1);
   return e;
 }
 
-cmark_parser *cmark_parser_new_with_mem_into_root(int options, cmark_mem *mem, cmark_node *root) {
-  cmark_parser *parser = (cmark_parser *)mem->calloc(1, sizeof(cmark_parser));
-  parser->mem = mem;
-
-  cmark_strbuf_init(mem, &parser->curline, 256);
-  cmark_strbuf_init(mem, &parser->linebuf, 0);
-  cmark_strbuf_init(mem, &parser->content, 0);
+// Reset per-document parser state, keeping allocated buffers.
+static void S_parser_reset(cmark_parser *parser, int options,
+                           cmark_node *root) {
+  cmark_strbuf_clear(&parser->curline);
+  cmark_strbuf_clear(&parser->linebuf);
+  cmark_strbuf_clear(&parser->content);
+  parser->line.data = NULL;
+  parser->line.len = 0;
+  parser->input_stable = false;
+  parser->line_src = NULL;
+  parser->content_src = NULL;
+  parser->content_len = 0;
+  parser->index = NULL;
+  parser->threads = 1;
 
   root->flags = CMARK_NODE__OPEN;
 
-  parser->refmap = cmark_reference_map_new(mem);
   parser->root = root;
   parser->current = root;
   parser->line_number = 0;
@@ -115,13 +163,38 @@ cmark_parser *cmark_parser_new_with_mem_into_root(int options, cmark_mem *mem, c
   parser->last_line_length = 0;
   parser->options = options;
   parser->last_buffer_ended_with_cr = false;
+  parser->finished = false;
+  parser->pool_start = cmark_node_pool_allocated(parser->pool);
+  parser->buffers_start = (size_t)parser->curline.asize +
+                          (size_t)parser->linebuf.asize +
+                          (size_t)parser->content.asize;
+  parser->data_size = 0;
+  parser->truncated = false;
+  parser->total_size = 0;
+}
+
+cmark_parser *cmark_parser_new_with_mem_into_root(int options, cmark_mem *mem, cmark_node *root) {
+  cmark_parser *parser = (cmark_parser *)mem->calloc(1, sizeof(cmark_parser));
+  parser->mem = mem;
+
+  cmark_strbuf_init(mem, &parser->curline, 256);
+  cmark_strbuf_init(mem, &parser->linebuf, 0);
+  cmark_strbuf_init(mem, &parser->content, 0);
+
+  parser->refmap = cmark_reference_map_new(mem);
+  parser->pool = cmark_node_pool_new(mem);
+  S_parser_reset(parser, options, root);
 
   return parser;
 }
 
 cmark_parser *cmark_parser_new_with_mem(int options, cmark_mem *mem) {
   cmark_node *document = make_document(mem);
-  return cmark_parser_new_with_mem_into_root(options, mem, document);
+  cmark_parser *parser =
+      cmark_parser_new_with_mem_into_root(options, mem, document);
+
+  parser->own_root = true;
+  return parser;
 }
 
 cmark_parser *cmark_parser_new(int options) {
@@ -129,20 +202,93 @@ cmark_parser *cmark_parser_new(int options) {
   return cmark_parser_new_with_mem(options, &DEFAULT_MEM_ALLOCATOR);
 }
 
+void cmark_parser_reset(cmark_parser *parser, int options) {
+  // A document that was never finished hasn't been handed out, unless
+  // the caller gave it to the parser.
+  if (!parser->finished && parser->own_root)
+    cmark_node_free(parser->root);
+  cmark_reference_map_clear(parser->refmap);
+  S_parser_reset(parser, options, make_document(parser->mem));
+  parser->own_root = true;
+}
+
+void cmark_parser_set_memory_limit(cmark_parser *parser, size_t limit) {
+  parser->memory_limit = limit;
+}
+
+// Returns the approximate number of bytes used for the document so far.
+// Nodes freed again while parsing are still counted, and buffer space
+// kept over from earlier documents is not.
+static size_t S_memory_used(cmark_parser *parser) {
+  size_t buffers = (size_t)parser->curline.asize +
+                   (size_t)parser->linebuf.asize +
+                   (size_t)parser->content.asize;
+
+  return (cmark_node_pool_allocated(parser->pool) - parser->pool_start) *
+             sizeof(cmark_node) +
+         parser->data_size +
+         (buffers > parser->buffers_start ? buffers - parser->buffers_start
+                                          : 0) +
+         parser->refmap->mem_size;
+}
+
+// Checks whether the parser should stop reading input, marking it as
+// truncated if so.  Half of the limit is left for the inline phase.
+static bool S_over_limit(cmark_parser *parser) {
+  if (parser->memory_limit && !parser->truncated &&
+      S_memory_used(parser) > parser->memory_limit / 2)
+    parser->truncated = true;
+  return parser->truncated;
+}
+
+// Returns how much of a line of 'len' bytes at 'buffer' fits in the
+// memory limit, counting the copies made of it.  A line that doesn't
+// fit is cut at a character boundary and the parser is marked as
+// truncated.
+static bufsize_t S_clamp_line(cmark_parser *parser,
+                              const unsigned char *buffer, bufsize_t len) {
+  size_t used = S_memory_used(parser);
+  size_t room = parser->memory_limit / 2;
+
+  room = used < room ? (room - used) / 2 : 0;
+  if ((size_t)len <= room)
+    return len;
+
+  parser->truncated = true;
+  len = (bufsize_t)room;
+  while (len > 0 && (buffer[len] & 0xC0) == 0x80)
+    len--;
+  return len;
+}
+
+// Frees everything following 'node' in document order.
+static void S_truncate_after(cmark_node *node) {
+  for (; node->parent; node = node->parent) {
+    while (node->next)
+      cmark_node_free(node->next);
+  }
+}
+
 void cmark_parser_free(cmark_parser *parser) {
   cmark_mem *mem = parser->mem;
   cmark_strbuf_free(&parser->curline);
   cmark_strbuf_free(&parser->linebuf);
+  cmark_strbuf_free(&parser->content);
   cmark_reference_map_free(parser->refmap);
+  cmark_node_pool_release(parser->pool);
+  if (parser->reparse) {
+    parser->reparse->pool = NULL;
+    cmark_parser_free(parser->reparse);
+  }
   mem->free(parser);
 }
 
 static cmark_node *finalize(cmark_parser *parser, cmark_node *b);
 
 // Returns true if line has only space characters, else false.
-static bool is_blank(cmark_strbuf *s, bufsize_t offset) {
-  while (offset < s->size) {
-    switch (s->ptr[offset]) {
+static bool is_blank(cmark_chunk *s, bufsize_t offset) {
+  while (offset < s->len) {
+    switch (s->data[offset]) {
     case '\r':
     case '\n':
       return true;
@@ -179,9 +325,66 @@ static inline bool contains_inlines(cmark_node_type block_type) {
           block_type == CMARK_NODE_HEADING);
 }
 
+// Returns the content of the open leaf block.
+static cmark_chunk S_content(cmark_parser *parser) {
+  cmark_chunk c;
+  if (parser->content_src) {
+    c.data = parser->content_src;
+    c.len = parser->content_len;
+  } else {
+    c.data = parser->content.ptr;
+    c.len = parser->content.size;
+  }
+  return c;
+}
+
+// Copies content kept as a span of the input into parser->content.
+static void S_content_materialize(cmark_parser *parser) {
+  if (parser->content_src) {
+    cmark_strbuf_set(&parser->content, parser->content_src,
+                     parser->content_len);
+    parser->content_src = NULL;
+    parser->content_len = 0;
+  }
+}
+
+static void S_content_drop(cmark_parser *parser, bufsize_t n) {
+  if (parser->content_src) {
+    parser->content_src += n;
+    parser->content_len -= n;
+  } else {
+    cmark_strbuf_drop(&parser->content, n);
+  }
+}
+
+static void S_content_clear(cmark_parser *parser) {
+  cmark_strbuf_clear(&parser->content);
+  parser->content_src = NULL;
+  parser->content_len = 0;
+}
+
 static void add_line(cmark_chunk *ch, cmark_parser *parser) {
   int chars_to_tab;
   int i;
+
+  // As long as the lines are adjacent in the input, just extend the
+  // span.
+  if (parser->line_src && !parser->partially_consumed_tab) {
+    const unsigned char *src = parser->line_src + parser->offset;
+    bufsize_t len = ch->len - parser->offset;
+    if (parser->content_src == NULL && parser->content.size == 0) {
+      parser->content_src = src;
+      parser->content_len = len;
+      return;
+    }
+    if (parser->content_src &&
+        parser->content_src + parser->content_len == src) {
+      parser->content_len += len;
+      return;
+    }
+  }
+
+  S_content_materialize(parser);
   if (parser->partially_consumed_tab) {
     parser->offset += 1; // skip over tab
     // add space characters:
@@ -194,31 +397,26 @@ static void add_line(cmark_chunk *ch, cmark_parser *parser) {
                    ch->len - parser->offset);
 }
 
-static void remove_trailing_blank_lines(cmark_strbuf *ln) {
+// Returns the length of 'ln' without its trailing blank lines.
+static bufsize_t S_trailing_blank_lines_start(cmark_chunk *ln) {
   bufsize_t i;
   unsigned char c;
 
-  for (i = ln->size - 1; i >= 0; --i) {
-    c = ln->ptr[i];
+  for (i = ln->len - 1; i >= 0; --i) {
+    c = ln->data[i];
 
     if (c != ' ' && c != '\t' && !S_is_line_end_char(c))
       break;
   }
 
-  if (i < 0) {
-    cmark_strbuf_clear(ln);
-    return;
-  }
-
-  for (; i < ln->size; ++i) {
-    c = ln->ptr[i];
-
-    if (!S_is_line_end_char(c))
-      continue;
+  if (i < 0)
+    return 0;
 
-    cmark_strbuf_truncate(ln, i);
-    break;
+  for (; i < ln->len; ++i) {
+    if (S_is_line_end_char(ln->data[i]))
+      return i;
   }
+  return ln->len;
 }
 
 // Check to see if a node ends with a blank line, descending
@@ -237,19 +435,56 @@ static bool S_ends_with_blank_line(cmark_node *node) {
 
 
 // returns true if content remains after link defs are resolved.
-static bool resolve_reference_link_definitions(cmark_parser *parser) {
+// 'line' is where the paragraph starts.
+static bool resolve_reference_link_definitions(cmark_parser *parser,
+                                               int line) {
   bufsize_t pos;
-  cmark_strbuf *node_content = &parser->content;
-  cmark_chunk chunk = {node_content->ptr, node_content->size};
+  cmark_chunk content = S_content(parser);
+  cmark_chunk chunk;
+  bool has_content;
+
+  // The scanners need the NUL terminator of a copy.
+  if (content.len && content.data[0] == '[') {
+    S_content_materialize(parser);
+    content = S_content(parser);
+  }
+  chunk = content;
   while (chunk.len && chunk.data[0] == '[' &&
          (pos = cmark_parse_reference_inline(parser->mem, &chunk,
-                                             parser->refmap))) {
+                                             parser->refmap, line))) {
 
     chunk.data += pos;
     chunk.len -= pos;
+    // Definitions take several times the memory of their source, so
+    // the rest of a long run of them is dropped once over the limit.
+    if (parser->memory_limit &&
+        S_memory_used(parser) > parser->memory_limit) {
+      parser->truncated = true;
+      chunk.len = 0;
+    }
   }
-  cmark_strbuf_drop(node_content, (node_content->size - chunk.len));
-  return !is_blank(node_content, 0);
+  // Dropping moves the bytes of a copy, so check what is left first.
+  has_content = !is_blank(&chunk, 0);
+  S_content_drop(parser, content.len - chunk.len);
+  return has_content;
+}
+
+// Hands the content over to 'b'.  Content that is still a span of the
+// input is borrowed from it; with CMARK_OPT_BORROW_INPUT that is for
+// good, otherwise only until the inline phase of cmark_parse_document.
+static void S_content_to_node(cmark_parser *parser, cmark_node *b,
+                              bufsize_t len) {
+  if (parser->content_src) {
+    b->data = (unsigned char *)parser->content_src;
+    b->flags |= CMARK_NODE__BORROWED;
+    parser->content_src = NULL;
+    parser->content_len = 0;
+  } else {
+    cmark_strbuf_truncate(&parser->content, len);
+    b->data = cmark_strbuf_detach(&parser->content);
+    parser->data_size += len;
+  }
+  b->len = len;
 }
 
 static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
@@ -264,7 +499,7 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
          CMARK_NODE__OPEN); // shouldn't call finalize on closed blocks
   b->flags &= ~CMARK_NODE__OPEN;
 
-  if (parser->curline.size == 0) {
+  if (parser->line.len == 0) {
     // end of input - line number has not been incremented
     b->end_line = parser->line_number;
     b->end_column = parser->last_line_length;
@@ -272,68 +507,83 @@ static cmark_node *finalize(cmark_parser *parser, cmark_node *b) {
              (S_type(b) == CMARK_NODE_CODE_BLOCK && b->as.code.fenced) ||
              (S_type(b) == CMARK_NODE_HEADING && b->as.heading.setext)) {
     b->end_line = parser->line_number;
-    b->end_column = parser->curline.size;
-    if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\n')
+    b->end_column = parser->line.len;
+    if (b->end_column && parser->line.data[b->end_column - 1] == '\n')
       b->end_column -= 1;
-    if (b->end_column && parser->curline.ptr[b->end_column - 1] == '\r')
+    if (b->end_column && parser->line.data[b->end_column - 1] == '\r')
       b->end_column -= 1;
   } else {
     b->end_line = parser->line_number - 1;
     b->end_column = parser->last_line_length;
   }
 
-  cmark_strbuf *node_content = &parser->content;
+  cmark_chunk content;
 
   switch (S_type(b)) {
   case CMARK_NODE_PARAGRAPH:
   {
-    has_content = resolve_reference_link_definitions(parser);
+    has_content = resolve_reference_link_definitions(parser, b->start_line);
     if (!has_content) {
       // remove blank node (former reference def)
       cmark_node_free(b);
     } else {
-      b->len = node_content->size;
-      b->data = cmark_strbuf_detach(node_content);
+      S_content_to_node(parser, b, S_content(parser).len);
     }
     break;
   }
 
   case CMARK_NODE_CODE_BLOCK:
+    // Literal blocks keep their content, so they can only borrow it
+    // when asked to.
+    if (!(parser->options & CMARK_OPT_BORROW_INPUT))
+      S_content_materialize(parser);
+    content = S_content(parser);
     if (!b->as.code.fenced) { // indented code
-      remove_trailing_blank_lines(node_content);
-      cmark_strbuf_putc(node_content, '\n');
+      pos = S_trailing_blank_lines_start(&content);
+      // A span of the input has the same line ending after the last
+      // line kept; a copy gets a new one.
+      if (!(parser->content_src && pos > 0 && pos < content.len &&
+            content.data[pos] == '\n')) {
+        S_content_materialize(parser);
+        cmark_strbuf_truncate(&parser->content, pos);
+        cmark_strbuf_putc(&parser->content, '\n');
+      }
+      S_content_to_node(parser, b, pos + 1);
     } else {
       // first line of contents becomes info
-      for (pos = 0; pos < node_content->size; ++pos) {
-        if (S_is_line_end_char(node_content->ptr[pos]))
+      for (pos = 0; pos < content.len; ++pos) {
+        if (S_is_line_end_char(content.data[pos]))
           break;
       }
-      assert(pos < node_content->size);
+      assert(pos < content.len);
 
       if (pos == 0) {
         b->as.code.info = NULL;
       } else {
         cmark_strbuf tmp = CMARK_BUF_INIT(parser->mem);
-        houdini_unescape_html_f(&tmp, node_content->ptr, pos);
+        houdini_unescape_html_f(&tmp, content.data, pos);
         cmark_strbuf_trim(&tmp);
         cmark_strbuf_unescape(&tmp);
         b->as.code.info = cmark_strbuf_detach(&tmp);
       }
 
-      if (node_content->ptr[pos] == '\r')
+      if (content.data[pos] == '\r')
         pos += 1;
-      if (node_content->ptr[pos] == '\n')
+      if (pos < content.len && content.data[pos] == '\n')
         pos += 1;
-      cmark_strbuf_drop(node_content, pos);
+      S_content_drop(parser, pos);
+      S_content_to_node(parser, b, S_content(parser).len);
     }
-    b->len = node_content->size;
-    b->data = cmark_strbuf_detach(node_content);
     break;
 
-  case CMARK_NODE_HEADING:
   case CMARK_NODE_HTML_BLOCK:
-    b->len = node_content->size;
-    b->data = cmark_strbuf_detach(node_content);
+    if (!(parser->options & CMARK_OPT_BORROW_INPUT))
+      S_content_materialize(parser);
+    S_content_to_node(parser, b, S_content(parser).len);
+    break;
+
+  case CMARK_NODE_HEADING:
+    S_content_to_node(parser, b, S_content(parser).len);
     break;
 
   case CMARK_NODE_LIST:      // determine tight/loose status
@@ -384,7 +634,8 @@ static cmark_node *add_child(cmark_parser *parser, cmark_node *parent,
   }
 
   cmark_node *child =
-      make_block(parser->mem, block_type, parser->line_number, start_column);
+      make_block(parser->mem, parser->pool, block_type, parser->line_number,
+                 start_column);
   child->parent = parent;
 
   if (parent->last_child) {
@@ -400,25 +651,225 @@ static cmark_node *add_child(cmark_parser *parser, cmark_node *parent,
 
 // Walk through node and all children, recursively, parsing
 // string content into inline content where appropriate.
-static void process_inlines(cmark_mem *mem, cmark_node *root,
-                            cmark_reference_map *refmap, int options) {
-  cmark_iter *iter = cmark_iter_new(root);
+// Drops the text of a leaf block once its inlines have been parsed.
+static void S_release_content(cmark_parser *parser, cmark_node *cur) {
+  if (!(cur->flags & CMARK_NODE__BORROWED)) {
+    parser->mem->free(cur->data);
+    parser->data_size -= cur->len;
+  }
+  cur->flags &= ~CMARK_NODE__BORROWED;
+  cur->data = NULL;
+  cur->len = 0;
+}
+
+// Returns the bytes allocated for the text of the inlines of 'leaf':
+// their literals and the destinations and titles of their links.
+static size_t S_inline_data_size(cmark_node *leaf) {
+  cmark_node *cur = leaf->first_child;
+  size_t size = 0;
+
+  while (cur) {
+    switch (cur->type) {
+    case CMARK_NODE_TEXT:
+    case CMARK_NODE_CODE:
+    case CMARK_NODE_HTML_INLINE:
+      if (cur->data && cmark_node__owns_data(cur))
+        size += (size_t)cur->len + 1;
+      break;
+    case CMARK_NODE_LINK:
+    case CMARK_NODE_IMAGE:
+      if (cur->as.link.url)
+        size += strlen((char *)cur->as.link.url) + 1;
+      if (cur->as.link.title)
+        size += strlen((char *)cur->as.link.title) + 1;
+      break;
+    default:
+      break;
+    }
+    if (cur->first_child) {
+      cur = cur->first_child;
+      continue;
+    }
+    while (cur != leaf && cur->next == NULL)
+      cur = cur->parent;
+    cur = cur == leaf ? NULL : cur->next;
+  }
+  return size;
+}
+
+// Leaf blocks are handed to the threads in runs of at least this many
+// bytes of content, so that each task is worth taking.
+#define INLINE_TASK_SIZE 16384
+
+// What each thread parses inlines with.  Nodes come from a pool of the
+// thread's own and labels are looked up in a view of the reference map.
+typedef struct {
+  cmark_node_pool *pool;
+  cmark_reference_map *refmap;
+  cmark_strbuf scratch;
+} inline_worker;
+
+typedef struct {
+  cmark_parser *parser;
+  cmark_node **leaves;
+  size_t *tasks; // task i parses leaves tasks[i] to tasks[i + 1] - 1
+  inline_worker *workers;
+} inline_job;
+
+static void S_parse_inlines_task(void *ctx, size_t task, int worker) {
+  inline_job *job = (inline_job *)ctx;
+  cmark_parser *parser = job->parser;
+  inline_worker *w = &job->workers[worker];
+  size_t i;
+
+  for (i = job->tasks[task]; i < job->tasks[task + 1]; i++)
+    cmark_parse_inlines(parser->mem, w->pool, job->leaves[i], w->refmap,
+                        parser->options, &w->scratch, parser->index, 0);
+}
+
+// Parses the inlines of all leaf blocks on up to parser->threads
+// threads.  Once the block structure is complete the reference map no
+// longer changes, so the leaves can be parsed in any order, except that
+// the expansion limit for references is spent in document order.
+// Returns false, leaving the leaves as they were, if there is too little
+// content to share out or the limit was reached, in which case the
+// serial parse has to decide which references still expand.
+static bool S_process_inlines_parallel(cmark_parser *parser) {
+  cmark_mem *mem = parser->mem;
+  cmark_iter *iter = cmark_iter_new(parser->root);
+  cmark_event_type ev_type;
+  cmark_node *cur;
+  cmark_node **leaves = NULL;
+  size_t nleaves = 0, capacity = 0, total = 0, size = 0, ntasks = 0;
+  size_t task_size, i;
+  uint64_t ref_size = parser->refmap->ref_size;
+  inline_worker *workers;
+  inline_job job;
+  int nworkers = parser->threads;
+  bool ok = true;
+
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    cur = cmark_iter_get_node(iter);
+    if (ev_type == CMARK_EVENT_ENTER && contains_inlines(S_type(cur))) {
+      if (nleaves == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        leaves = (cmark_node **)mem->realloc(leaves,
+                                             capacity * sizeof(*leaves));
+      }
+      leaves[nleaves++] = cur;
+      total += (size_t)cur->len;
+    }
+  }
+  cmark_iter_free(iter);
+
+  task_size = total / ((size_t)nworkers * 4);
+  if (task_size < INLINE_TASK_SIZE)
+    task_size = INLINE_TASK_SIZE;
+  if (total < 2 * task_size) {
+    mem->free(leaves);
+    return false;
+  }
+
+  job.parser = parser;
+  job.leaves = leaves;
+  job.tasks = (size_t *)mem->calloc(nleaves + 1, sizeof(size_t));
+  for (i = 0; i < nleaves; i++) {
+    size += (size_t)leaves[i]->len;
+    if (size >= task_size || i + 1 == nleaves) {
+      job.tasks[++ntasks] = i + 1;
+      size = 0;
+    }
+  }
+
+  workers = (inline_worker *)mem->calloc((size_t)nworkers, sizeof(*workers));
+  for (i = 0; i < (size_t)nworkers; i++) {
+    workers[i].pool = cmark_node_pool_new(mem);
+    workers[i].refmap = cmark_reference_map_view(parser->refmap);
+    cmark_strbuf_init(mem, &workers[i].scratch, 0);
+  }
+  job.workers = workers;
+
+  cmark_run_tasks(S_parse_inlines_task, &job, ntasks, nworkers);
+
+  for (i = 0; i < (size_t)nworkers; i++) {
+    cmark_reference_map *view = workers[i].refmap;
+    if (view->exhausted)
+      ok = false;
+    ref_size += view->ref_size - parser->refmap->ref_size;
+  }
+  if (parser->refmap->max_ref_size && ref_size > parser->refmap->max_ref_size)
+    ok = false;
+
+  for (i = 0; i < nleaves; i++) {
+    if (ok) {
+      S_release_content(parser, leaves[i]);
+    } else {
+      while (leaves[i]->first_child)
+        cmark_node_free(leaves[i]->first_child);
+    }
+  }
+  if (ok)
+    parser->refmap->ref_size = (unsigned int)ref_size;
+
+  for (i = 0; i < (size_t)nworkers; i++) {
+    cmark_node_pool_release(workers[i].pool);
+    cmark_reference_map_free(workers[i].refmap);
+    cmark_strbuf_free(&workers[i].scratch);
+  }
+  mem->free(workers);
+  mem->free(job.tasks);
+  mem->free(leaves);
+  return ok;
+}
+
+static void process_inlines(cmark_parser *parser) {
+  cmark_iter *iter;
   cmark_node *cur;
+  cmark_node *last = NULL;
   cmark_event_type ev_type;
+  size_t node_limit = 0;
 
+  if (parser->threads > 1 && !parser->memory_limit &&
+      S_process_inlines_parallel(parser))
+    return;
+
+  iter = cmark_iter_new(parser->root);
   while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
     cur = cmark_iter_get_node(iter);
     if (ev_type == CMARK_EVENT_ENTER) {
       if (contains_inlines(S_type(cur))) {
-        cmark_parse_inlines(mem, cur, refmap, options);
-        mem->free(cur->data);
-        cur->data = NULL;
-        cur->len = 0;
+        // The inline parser stops once the pool holds as many nodes as
+        // the rest of the budget allows.
+        if (parser->memory_limit) {
+          size_t used = S_memory_used(parser);
+          node_limit = cmark_node_pool_allocated(parser->pool) + 1 +
+                       (used < parser->memory_limit
+                            ? (parser->memory_limit - used) / sizeof(cmark_node)
+                            : 0);
+        }
+        if (!cmark_parse_inlines(parser->mem, parser->pool, cur,
+                                 parser->refmap, parser->options,
+                                 &parser->curline, parser->index,
+                                 node_limit))
+          last = cur;
+        if (parser->memory_limit)
+          parser->data_size += S_inline_data_size(cur);
+        S_release_content(parser, cur);
+        if (parser->memory_limit &&
+            S_memory_used(parser) > parser->memory_limit)
+          last = cur;
+        if (last)
+          break;
       }
     }
   }
 
   cmark_iter_free(iter);
+
+  if (last) {
+    parser->truncated = true;
+    S_truncate_after(last);
+  }
 }
 
 // Attempts to parse a list item marker (bullet or enumerated).
@@ -518,30 +969,40 @@ static int lists_match(cmark_list *list_data, cmark_list *item_data) {
           list_data->bullet_char == item_data->bullet_char);
 }
 
-static cmark_node *finalize_document(cmark_parser *parser) {
+static void S_finalize_blocks(cmark_parser *parser) {
   while (parser->current != parser->root) {
     parser->current = finalize(parser, parser->current);
   }
 
   finalize(parser, parser->root);
+}
 
-  // Limit total size of extra content created from reference links to
-  // document size to avoid superlinear growth. Always allow 100KB.
-  if (parser->total_size > 100000)
-    parser->refmap->max_ref_size = parser->total_size;
+// Limit total size of extra content created from reference links to
+// document size to avoid superlinear growth. Always allow 100KB.
+static void S_limit_ref_size(cmark_reference_map *refmap,
+                             unsigned int total_size) {
+  if (total_size > 100000)
+    refmap->max_ref_size = total_size;
   else
-    parser->refmap->max_ref_size = 100000;
+    refmap->max_ref_size = 100000;
+}
+
+static cmark_node *finalize_document(cmark_parser *parser) {
+  S_finalize_blocks(parser);
+  S_limit_ref_size(parser->refmap, parser->total_size);
 
-  process_inlines(parser->mem, parser->root, parser->refmap, parser->options);
+  process_inlines(parser);
 
-  cmark_strbuf_free(&parser->content);
+  S_content_clear(parser);
 
   return parser->root;
 }
 
 cmark_node *cmark_parse_file(FILE *f, int options) {
   unsigned char buffer[4096];
-  cmark_parser *parser = cmark_parser_new(options);
+  // The buffer is reused, so nothing can be borrowed from it.
+  cmark_parser *parser =
+      cmark_parser_new(options & ~CMARK_OPT_BORROW_INPUT);
   size_t bytes;
   cmark_node *document;
 
@@ -558,17 +1019,619 @@ cmark_node *cmark_parse_file(FILE *f, int options) {
   return document;
 }
 
-cmark_node *cmark_parse_document(const char *buffer, size_t len, int options) {
-  cmark_parser *parser = cmark_parser_new(options);
+// Large documents are split for parsing on several threads into pieces
+// of about this size or more.
+#define BLOCK_CHUNK_SIZE (1 << 20)
+
+// A piece of the input whose blocks are parsed on a thread of its own,
+// on the guess that it starts outside of any container block.
+typedef struct {
+  size_t start;
+  size_t end;
+  int line_number; // of the line before the piece
+  cmark_parser *parser;
+} block_chunk;
+
+typedef struct {
+  const unsigned char *input;
+  int options;
+  const cmark_structural_index *index;
+  block_chunk *chunks;
+  size_t nchunks;
+} block_job;
+
+// Returns the position at or after 'pos' of the start of a line that
+// follows a blank line and starts with something other than whitespace,
+// where one top-level block has most likely ended and the next begins.
+// Returns 'end' if there is none before it.
+static size_t S_find_chunk_start(const unsigned char *input, size_t pos,
+                                 size_t end) {
+  const unsigned char *p = input + pos, *stop = input + end, *q;
+
+  while ((p = (const unsigned char *)memchr(p, '\n', stop - p)) != NULL) {
+    q = p + 1;
+    while (q < stop && S_is_space_or_tab(*q))
+      q++;
+    if (q < stop && *q == '\r')
+      q++;
+    if (q + 1 < stop && *q == '\n' && !cmark_isspace(q[1]) && q[1] != '\0')
+      return (size_t)(q + 1 - input);
+    p = q;
+  }
+  return end;
+}
+
+// Counts the lines ending in [p, end) the way S_parser_feed does.
+static int S_count_lines(const unsigned char *p, const unsigned char *end) {
+  int lines = 0;
+
+  for (; p < end; p++) {
+    if (*p == '\n' || (*p == '\r' && (p + 1 == end || p[1] != '\n')))
+      lines++;
+  }
+  return lines;
+}
+
+static void S_parse_chunk_task(void *ctx, size_t task, int worker) {
+  block_job *job = (block_job *)ctx;
+  block_chunk *chunk = &job->chunks[task];
+  cmark_parser *parser = cmark_parser_new(job->options);
+
+  (void)worker;
+  parser->input_stable = true;
+  parser->index = job->index;
+  parser->line_number = chunk->line_number;
+  S_parser_feed(parser, job->input + chunk->start, chunk->end - chunk->start,
+                task + 1 == job->nchunks);
+  chunk->parser = parser;
+}
+
+// Parses the block structure of 'input' in pieces on up to 'threads'
+// threads, and returns the parser that is left to finish the document.
+// Each piece but the first is parsed as if it began a document, which
+// holds whenever nothing but the document is open where it starts.  The
+// pieces are then joined in order: while the parser of the pieces so far
+// ends with only the document open, the next piece's parser takes over
+// the blocks and references so far.  Otherwise the guess was wrong and
+// the piece is parsed again, continuing from the piece before it.
+static cmark_parser *S_parse_blocks_parallel(const unsigned char *input,
+                                             size_t len, int options,
+                                             int threads,
+                                             const cmark_structural_index *index) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  size_t nchunks = len / BLOCK_CHUNK_SIZE, target, pos = 0, i;
+  block_chunk *chunks;
+  block_job job;
+  cmark_parser *parser, *next;
+  int lines = 0;
+
+  if (nchunks > (size_t)threads * 2)
+    nchunks = (size_t)threads * 2;
+  target = len / nchunks;
+
+  chunks = (block_chunk *)mem->calloc(nchunks, sizeof(*chunks));
+  for (i = 0; i < nchunks && pos < len; i++) {
+    size_t end = i + 1 == nchunks || pos + target >= len
+                     ? len
+                     : S_find_chunk_start(input, pos + target, len);
+    chunks[i].start = pos;
+    chunks[i].end = end;
+    chunks[i].line_number = lines;
+    if (end < len)
+      lines += S_count_lines(input + pos, input + end);
+    pos = end;
+  }
+  job.input = input;
+  job.options = options;
+  job.index = index;
+  job.chunks = chunks;
+  job.nchunks = i;
+
+  cmark_run_tasks(S_parse_chunk_task, &job, job.nchunks, threads);
+
+  parser = chunks[0].parser;
+  for (i = 1; i < job.nchunks; i++) {
+    next = chunks[i].parser;
+    if (parser->current == parser->root) {
+      cmark_node *child;
+      cmark_reference_map *refmap;
+
+      while ((child = parser->root->last_child) != NULL)
+        cmark_node_prepend_child(next->root, child);
+      cmark_reference_map_merge(parser->refmap, next->refmap);
+      refmap = next->refmap;
+      next->refmap = parser->refmap;
+      parser->refmap = refmap;
+      if (parser->total_size > UINT_MAX - next->total_size)
+        next->total_size = UINT_MAX;
+      else
+        next->total_size += parser->total_size;
+      next->data_size += parser->data_size;
+    } else {
+      // Parse the piece again after the one before it.
+      S_parser_feed(parser, input + chunks[i].start,
+                    chunks[i].end - chunks[i].start, i + 1 == job.nchunks);
+      next = parser;
+      parser = chunks[i].parser;
+    }
+    cmark_node_free(parser->root);
+    cmark_parser_free(parser);
+    parser = next;
+  }
+
+  mem->free(chunks);
+  return parser;
+}
+
+static cmark_node *S_parse_document(const char *buffer, size_t len,
+                                    int options, int threads) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  const unsigned char *input = (const unsigned char *)buffer;
+  cmark_structural_index index;
+  const cmark_structural_index *indexed = NULL;
+  cmark_parser *parser;
   cmark_node *document;
 
-  S_parser_feed(parser, (const unsigned char *)buffer, len, true);
+  if (len <= INT32_MAX &&
+      cmark_structural_index_build(&index, mem, input, (bufsize_t)len,
+                                   options))
+    indexed = &index;
+
+  if (threads > 1 && len >= 2 * BLOCK_CHUNK_SIZE) {
+    parser = S_parse_blocks_parallel(input, len, options, threads, indexed);
+  } else {
+    parser = cmark_parser_new(options);
+    // The buffer outlives the parser, so lines and the content of blocks
+    // can be used in place.
+    parser->input_stable = true;
+    parser->index = indexed;
+    S_parser_feed(parser, input, len, true);
+  }
 
+  parser->threads = threads;
   document = cmark_parser_finish(parser);
+  if (indexed)
+    cmark_structural_index_free(&index, mem);
   cmark_parser_free(parser);
   return document;
 }
 
+cmark_node *cmark_parser_parse_buffer(cmark_parser *parser, const char *buffer,
+                                      size_t len, int options) {
+  const unsigned char *input = (const unsigned char *)buffer;
+  cmark_structural_index index;
+  cmark_node *document;
+
+  cmark_parser_reset(parser, options);
+  parser->input_stable = true;
+  if (len <= INT32_MAX &&
+      cmark_structural_index_build(&index, parser->mem, input, (bufsize_t)len,
+                                   options))
+    parser->index = &index;
+  S_parser_feed(parser, input, len, true);
+
+  document = cmark_parser_finish(parser);
+  if (parser->index) {
+    parser->index = NULL;
+    cmark_structural_index_free(&index, parser->mem);
+  }
+  return document;
+}
+
+// Incremental parsing.  A line on which a top-level block begins is
+// parsed the same way whatever comes before it:  the blocks before it
+// are closed by that line, and nothing of theirs affects the new block.
+// So when an edit leaves the lines before the last top-level block that
+// starts above it alone, the blocks from that one on can be parsed again
+// as if they began a document.  Once a top-level block begins on a line
+// after the edit where one also began before, the rest of the document
+// is parsed as before and the old blocks are kept, moved down or up by
+// the number of lines the edit added or removed.
+
+// Returns the start of each line of 'input', split the way
+// S_parser_feed splits it, followed by 'len', and sets '*nlines' to
+// the number of lines.
+static size_t *S_line_starts(cmark_mem *mem, const unsigned char *input,
+                             size_t len, int *nlines) {
+  int n = S_count_lines(input, input + len);
+  size_t *lines, i;
+
+  if (len && !S_is_line_end_char(input[len - 1]))
+    n++;
+  lines = (size_t *)mem->calloc((size_t)n + 1, sizeof(size_t));
+  *nlines = 0;
+  for (i = 0; i < len; i++) {
+    if (input[i] == '\n' ||
+        (input[i] == '\r' && (i + 1 == len || input[i + 1] != '\n')))
+      lines[++*nlines] = i + 1;
+  }
+  lines[n] = len;
+  *nlines = n;
+  return lines;
+}
+
+// Returns the line, counting from 1, that holds 'pos', which is before
+// the end of the input.
+static int S_line_of(const size_t *lines, int nlines, size_t pos) {
+  int lo = 1, hi = nlines, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (lines[mid - 1] <= pos)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Returns the length S_process_line records in 'last_line_length' for
+// line 'line' of 'input', which is where blocks closed by the next line
+// end.  The line buffers of 'parser', which must be empty, are used as
+// scratch space.
+static bufsize_t S_processed_length(cmark_parser *parser,
+                                    const unsigned char *input,
+                                    const size_t *lines, int line) {
+  static const uint8_t repl[] = {239, 191, 189};
+  const unsigned char *p = input + lines[line - 1], *end = input + lines[line];
+  cmark_strbuf *buf = &parser->curline, *checked = &parser->linebuf;
+  bufsize_t len;
+
+  while (end > p && S_is_line_end_char(end[-1]))
+    end--;
+  if (line == 1 && end - p >= 3 && p[0] == 0xEF && p[1] == 0xBB &&
+      p[2] == 0xBF)
+    p += 3;
+  for (; p < end; p++) {
+    if (*p == '\0')
+      cmark_strbuf_put(buf, repl, 3);
+    else
+      cmark_strbuf_putc(buf, *p);
+  }
+  len = buf->size;
+  if (parser->options & CMARK_OPT_VALIDATE_UTF8) {
+    cmark_utf8proc_check(checked, buf->ptr, buf->size);
+    len = checked->size;
+  }
+  cmark_strbuf_clear(buf);
+  cmark_strbuf_clear(checked);
+  return len;
+}
+
+// Returns the parser of the regions of 'parser', reset for a new one.
+// It is kept from one call of cmark_parser_reparse to the next, and its
+// nodes come from the pool of 'parser', so that the nodes of a region
+// take the place of those they replace.
+static cmark_parser *S_region_parser(cmark_parser *parser) {
+  cmark_parser *region = parser->reparse;
+
+  if (region == NULL) {
+    region = cmark_parser_new_with_mem(parser->options, parser->mem);
+    cmark_node_pool_release(region->pool);
+    region->pool = parser->pool;
+    parser->reparse = region;
+  }
+  cmark_parser_reset(region, parser->options);
+  region->input_stable = true;
+  return region;
+}
+
+// Parses the blocks of 'input' from line 'line' on with the region
+// parser, as if the line began a document, until a top-level block
+// begins on one of the 'nstops' lines in 'stops', which are in order, or
+// the input ends.  That block is dropped, and '*stop' set to the index
+// of its line in 'stops', or to 'nstops' at the end of the input.
+// Returns the document of the region, its blocks closed with their
+// inlines unparsed.  Its definitions are in the region parser's
+// reference map until the next region is parsed.
+static cmark_node *S_reparse_blocks(cmark_parser *parser,
+                                    const unsigned char *input,
+                                    const size_t *lines, int nlines,
+                                    int line, const int *stops,
+                                    size_t nstops, size_t *stop) {
+  cmark_parser *region = S_region_parser(parser);
+  cmark_node *last;
+  size_t j = 0;
+  int k;
+
+  region->line_number = line - 1;
+  if (line > 1)
+    region->last_line_length =
+        S_processed_length(region, input, lines, line - 1);
+  *stop = nstops;
+  for (k = line; k <= nlines; k++) {
+    S_parser_feed(region, input + lines[k - 1], lines[k] - lines[k - 1],
+                  k == nlines);
+    while (j < nstops && stops[j] < k)
+      j++;
+    last = region->root->last_child;
+    if (j < nstops && stops[j] == k && last && last->start_line == k) {
+      cmark_node_free(last);
+      region->current = region->root;
+      *stop = j;
+      break;
+    }
+  }
+  // A last line without a line ending that was split at NUL bytes is
+  // still waiting in linebuf, as in cmark_parser_finish.
+  if (region->linebuf.size) {
+    S_process_line(region, region->linebuf.ptr, region->linebuf.size);
+    cmark_strbuf_clear(&region->linebuf);
+  }
+  S_finalize_blocks(region);
+  S_content_clear(region);
+  // The document is handed out, so that resetting the parser keeps it.
+  region->finished = true;
+  return region->root;
+}
+
+// Parses the inlines of the blocks of the region document 'root' with
+// the reference map of 'parser', and finishes them as
+// cmark_parser_finish would.
+static void S_reparse_inlines(cmark_parser *parser, cmark_node *root) {
+  cmark_parser *region = parser->reparse;
+  cmark_reference_map *refmap = region->refmap;
+  cmark_node *region_root = region->root;
+
+  region->refmap = parser->refmap;
+  region->root = root;
+  process_inlines(region);
+  region->refmap = refmap;
+  region->root = region_root;
+  cmark_consolidate_text_nodes(root);
+}
+
+static void S_shift_lines(cmark_node *block, int delta) {
+  cmark_iter *iter = cmark_iter_new(block);
+  cmark_event_type ev_type;
+  cmark_node *cur;
+
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    if (ev_type != CMARK_EVENT_ENTER)
+      continue;
+    cur = cmark_iter_get_node(iter);
+    if (cur->start_line)
+      cur->start_line += delta;
+    if (cur->end_line)
+      cur->end_line += delta;
+  }
+  cmark_iter_free(iter);
+}
+
+// Gives the blocks within 'block' that were closed by its first line,
+// and so end on the line before it, the new length of that line.
+static void S_set_early_ends(cmark_node *block, int column) {
+  cmark_iter *iter = cmark_iter_new(block);
+  cmark_event_type ev_type;
+  cmark_node *cur;
+
+  while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
+    cur = cmark_iter_get_node(iter);
+    if (ev_type == CMARK_EVENT_ENTER && cur->end_line == block->start_line - 1)
+      cur->end_column = column;
+  }
+  cmark_iter_free(iter);
+}
+
+// Returns true if any of the NUL-separated normalized 'labels' may be
+// looked up by the inlines of 'len' bytes of source at 'text'.  A label
+// is matched on its raw text, so the longest run of ASCII other than
+// spaces in the normalized label appears, case folded, in the source of
+// every link that refers to it.
+static bool S_may_refer_to(cmark_strbuf *folded, const unsigned char *text,
+                           size_t len, const cmark_strbuf *labels) {
+  const unsigned char *label = labels->ptr, *end = labels->ptr + labels->size;
+  const unsigned char *key, *p, *run;
+  size_t key_len, run_len, i;
+
+  cmark_strbuf_clear(folded);
+  cmark_utf8proc_case_fold(folded, text, (bufsize_t)len);
+  while (label < end) {
+    key = run = label;
+    key_len = run_len = 0;
+    for (p = label; *p; p++) {
+      if (*p < 0x80 && *p != ' ') {
+        if (run_len++ == 0)
+          run = p;
+        if (run_len > key_len) {
+          key = run;
+          key_len = run_len;
+        }
+      } else {
+        run_len = 0;
+      }
+    }
+    if (key_len == 0)
+      return true;
+    for (i = 0; i + key_len <= (size_t)folded->size; i++) {
+      if (folded->ptr[i] == key[0] &&
+          memcmp(folded->ptr + i, key, key_len) == 0)
+        return true;
+    }
+    label = p + 1;
+  }
+  return false;
+}
+
+// A run of old top-level blocks, old[first] to old[last - 1], and the
+// document holding the blocks that replace them.
+typedef struct {
+  cmark_node *root;
+  size_t first;
+  size_t last;
+} reparse_region;
+
+cmark_node *cmark_parser_reparse(cmark_parser *parser, cmark_node *document,
+                                 const char *buffer, size_t len,
+                                 size_t edit_start, size_t edit_old_end,
+                                 size_t edit_new_end) {
+  cmark_mem *mem = parser->mem;
+  const unsigned char *input = (const unsigned char *)buffer;
+  size_t *lines = NULL;
+  cmark_node **old = NULL, *node;
+  int *stops = NULL;
+  reparse_region *regions = NULL;
+  size_t nold = 0, nregions = 0, from, suffix, stop, i;
+  int nlines, first_changed, first_kept, delta, line;
+  cmark_strbuf changed = CMARK_BUF_INIT(mem);
+  cmark_strbuf folded = CMARK_BUF_INIT(mem);
+
+  if (document == NULL || document != parser->root || !parser->finished ||
+      (parser->options & (CMARK_OPT_BORROW_INPUT | CMARK_OPT_COMPACT)) ||
+      parser->memory_limit || parser->truncated ||
+      parser->refmap->exhausted || len > INT32_MAX ||
+      edit_start > edit_old_end || edit_start > edit_new_end ||
+      edit_new_end > len ||
+      len - edit_new_end + edit_old_end != parser->total_size)
+    goto full;
+
+  // Lines before 'first_changed' are as they were, and so are the lines
+  // from 'first_kept' on, which were 'delta' lines higher up.  The line
+  // before the edit counts as changed, as the edit may have split its
+  // line ending.
+  lines = S_line_starts(mem, input, len, &nlines);
+  first_changed = edit_start ? S_line_of(lines, nlines, edit_start - 1) : 1;
+  first_kept = edit_new_end < len ? S_line_of(lines, nlines, edit_new_end) + 1
+                                  : nlines + 1;
+  delta = nlines - parser->line_number;
+
+  for (node = document->first_child; node; node = node->next)
+    nold++;
+  old = (cmark_node **)mem->calloc(nold + 1, sizeof(*old));
+  stops = (int *)mem->calloc(nold + 1, sizeof(*stops));
+  regions = (reparse_region *)mem->calloc(nold + 1, sizeof(*regions));
+  for (node = document->first_child, i = 0; node; node = node->next)
+    old[i++] = node;
+
+  // Start from the last block that begins on an unchanged line, and stop
+  // where a block begins that began on an unchanged line after the edit.
+  for (from = 0; from < nold && old[from]->start_line < first_changed; from++)
+    ;
+  if (from > 0)
+    from--;
+  line = from < nold && old[from]->start_line < first_changed
+             ? old[from]->start_line
+             : 1;
+  for (suffix = from; suffix < nold &&
+                      old[suffix]->start_line < first_kept - delta;
+       suffix++)
+    ;
+  for (i = suffix; i < nold; i++)
+    stops[i - suffix] = old[i]->start_line + delta;
+
+  regions[0].root = S_reparse_blocks(parser, input, lines, nlines, line,
+                                     stops, nold - suffix, &stop);
+  regions[0].first = from;
+  regions[0].last = suffix + stop;
+  nregions = 1;
+
+  if (!cmark_reference_map_splice(
+          parser->refmap, line,
+          regions[0].last < nold ? old[regions[0].last]->start_line : INT_MAX,
+          delta, parser->reparse->refmap, &changed))
+    goto full;
+
+  // Kept blocks whose links may refer to a label whose definition
+  // changed are parsed again.  Their block structure stays the same.
+  if (changed.size) {
+    for (i = 0; i < nold; i++) {
+      int start, next;
+
+      if (i >= from && i < regions[0].last)
+        continue;
+      start = old[i]->start_line + (i >= from ? delta : 0);
+      next = i + 1 < nold ? old[i + 1]->start_line + (i + 1 >= from ? delta : 0)
+                          : nlines + 1;
+      if (i + 1 == from)
+        next = line;
+      if (!S_may_refer_to(&folded, input + lines[start - 1],
+                          lines[next - 1] - lines[start - 1], &changed))
+        continue;
+      stops[0] = next;
+      regions[nregions].root =
+          S_reparse_blocks(parser, input, lines, nlines, start, stops,
+                           next <= nlines ? 1 : 0, &stop);
+      regions[nregions].first = i;
+      regions[nregions].last = i + 1;
+      nregions++;
+      if (next <= nlines && stop != 0)
+        goto full;
+    }
+  }
+
+  S_limit_ref_size(parser->refmap, (unsigned int)len);
+  for (i = 0; i < nregions; i++)
+    S_reparse_inlines(parser, regions[i].root);
+  if (parser->refmap->exhausted)
+    goto full;
+
+  // Nothing can fail from here on:  put the new blocks in place of the
+  // old ones.
+  if (delta) {
+    for (i = regions[0].last; i < nold; i++)
+      S_shift_lines(old[i], delta);
+  }
+  if (regions[0].last < nold && old[regions[0].last]->start_line > 1)
+    S_set_early_ends(old[regions[0].last],
+                     S_processed_length(parser, input, lines,
+                                        old[regions[0].last]->start_line - 1));
+  if (regions[0].last == nold) {
+    document->end_line = regions[0].root->end_line;
+    document->end_column = regions[0].root->end_column;
+  } else {
+    document->end_line += delta;
+  }
+  for (i = 0; i < nregions; i++) {
+    cmark_node *root = regions[i].root, *anchor;
+    size_t j;
+
+    anchor = regions[i].first < regions[i].last ? old[regions[i].first]
+             : regions[i].last < nold            ? old[regions[i].last]
+                                                 : NULL;
+    while ((node = root->first_child) != NULL) {
+      if (anchor)
+        cmark_node_insert_before(anchor, node);
+      else
+        cmark_node_append_child(document, node);
+    }
+    for (j = regions[i].first; j < regions[i].last; j++)
+      cmark_node_free(old[j]);
+  }
+  document->as.document.source_size = (unsigned int)len;
+  parser->total_size = (unsigned int)len;
+  parser->line_number = nlines;
+  goto done;
+
+full:
+  if (document && !(document == parser->root && !parser->finished))
+    cmark_node_free(document);
+  document = NULL;
+
+done:
+  for (i = 0; i < nregions; i++)
+    cmark_node_free(regions[i].root);
+  mem->free(regions);
+  mem->free(stops);
+  mem->free(old);
+  mem->free(lines);
+  cmark_strbuf_free(&changed);
+  cmark_strbuf_free(&folded);
+  if (document == NULL)
+    document = cmark_parser_parse_buffer(parser, buffer, len, parser->options);
+  return document;
+}
+
+cmark_node *cmark_parse_document(const char *buffer, size_t len, int options) {
+  return S_parse_document(buffer, len, options, 1);
+}
+
+cmark_node *cmark_parse_document_parallel(const char *buffer, size_t len,
+                                          int options, int nthreads) {
+  if (nthreads <= 0)
+    nthreads = cmark_thread_count();
+  return S_parse_document(buffer, len, options, nthreads);
+}
+
 void cmark_parser_feed(cmark_parser *parser, const char *buffer, size_t len) {
   S_parser_feed(parser, (const unsigned char *)buffer, len, false);
 }
@@ -577,11 +1640,18 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
                           size_t len, bool eof) {
   const unsigned char *end = buffer + len;
   static const uint8_t repl[] = {239, 191, 189};
+  size_t expected;
 
   if (len > UINT_MAX - parser->total_size)
     parser->total_size = UINT_MAX;
   else
     parser->total_size += (int)len;
+  expected = parser->total_size / BYTES_PER_NODE;
+  // Under a memory limit, don't reserve nodes beyond it.
+  if (parser->memory_limit &&
+      expected > parser->memory_limit / sizeof(cmark_node))
+    expected = parser->memory_limit / sizeof(cmark_node);
+  cmark_node_pool_expect(parser->pool, expected);
 
   // Skip UTF-8 BOM if present; see #334
   if (parser->line_number == 0 && parser->column == 0 && len >= 3 &&
@@ -594,17 +1664,33 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
   }
 
   parser->last_buffer_ended_with_cr = false;
+  // Input before this is known to be valid UTF-8 (see below).
+  const unsigned char *valid_end = buffer;
   while (buffer < end) {
     const unsigned char *eol;
     bufsize_t chunk_len;
     bool process = false;
-    for (eol = buffer; eol < end; ++eol) {
-      if (S_is_line_end_char(*eol)) {
-        process = true;
-        break;
-      }
-      if (*eol == '\0' && eol < end) {
-        break;
+
+    if (S_over_limit(parser)) {
+      cmark_strbuf_clear(&parser->linebuf);
+      return;
+    }
+
+    if (parser->index) {
+      const unsigned char *input = parser->index->input;
+      eol = input + cmark_structural_next(parser->index->line_ends,
+                                          (bufsize_t)(buffer - input),
+                                          (bufsize_t)(end - input));
+      process = eol < end && *eol != '\0';
+    } else {
+      for (eol = buffer; eol < end; ++eol) {
+        if (S_is_line_end_char(*eol)) {
+          process = true;
+          break;
+        }
+        if (*eol == '\0' && eol < end) {
+          break;
+        }
       }
     }
     if (eol >= end && eof) {
@@ -612,13 +1698,38 @@ static void S_parser_feed(cmark_parser *parser, const unsigned char *buffer,
     }
 
     chunk_len = (eol - buffer);
+    if (parser->memory_limit) {
+      bufsize_t fits = S_clamp_line(parser, buffer, chunk_len);
+      if (fits < chunk_len) {
+        chunk_len = fits;
+        eol = buffer + fits;
+        process = true;
+      }
+    }
     if (process) {
       if (parser->linebuf.size > 0) {
         cmark_strbuf_put(&parser->linebuf, buffer, chunk_len);
         S_process_line(parser, parser->linebuf.ptr, parser->linebuf.size);
         cmark_strbuf_clear(&parser->linebuf);
       } else {
+        // With CMARK_OPT_VALIDATE_UTF8, the rest of the input is
+        // validated in one go, up to the first invalid sequence.  Lines
+        // before that don't need repairing.
+        bool valid = true;
+        if (parser->options & CMARK_OPT_VALIDATE_UTF8) {
+          if (buffer >= valid_end)
+            valid_end = buffer + cmark_utf8proc_valid_prefix(
+                                     buffer, (bufsize_t)(end - buffer));
+          valid = eol <= valid_end;
+        }
+        // The line can be used in place if it is followed by a
+        // newline, like the copy S_process_line would make of it.
+        if ((parser->input_stable ||
+             (parser->options & CMARK_OPT_BORROW_INPUT)) &&
+            valid && eol < end && *eol == '\n')
+          parser->line_src = buffer;
         S_process_line(parser, buffer, chunk_len);
+        parser->line_src = NULL;
       }
     } else {
       if (eol < end && *eol == '\0') {
@@ -816,6 +1927,17 @@ static bool parse_node_item_prefix(cmark_parser *parser, cmark_chunk *input,
   return res;
 }
 
+// The re2c scanners need a NUL after the line, so a line that is used
+// in place in the input is copied to parser->curline before the first
+// scanner call on it.
+static cmark_chunk *S_scannable(cmark_parser *parser, cmark_chunk *input) {
+  if (input->data != parser->curline.ptr) {
+    cmark_strbuf_set(&parser->curline, input->data, input->len);
+    input->data = parser->curline.ptr;
+  }
+  return input;
+}
+
 static bool parse_code_block_prefix(cmark_parser *parser, cmark_chunk *input,
                                     cmark_node *container,
                                     bool *should_continue) {
@@ -835,7 +1957,8 @@ static bool parse_code_block_prefix(cmark_parser *parser, cmark_chunk *input,
 
     if (parser->indent <= 3 && (peek_at(input, parser->first_nonspace) ==
                                 container->as.code.fence_char)) {
-      matched = scan_close_code_fence(input, parser->first_nonspace);
+      matched = scan_close_code_fence(S_scannable(parser, input),
+                                      parser->first_nonspace);
     }
 
     if (matched >= container->as.code.fence_length) {
@@ -987,14 +2110,26 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
   bool has_content;
   int save_offset;
   int save_column;
+  uint8_t starts;
 
   while (cont_type != CMARK_NODE_CODE_BLOCK &&
          cont_type != CMARK_NODE_HTML_BLOCK) {
 
+    // A single line can open any number of containers.
+    if (parser->memory_limit && S_over_limit(parser))
+      break;
+
     S_find_first_nonspace(parser, input);
     indented = parser->indent >= CODE_INDENT;
+    if (indented) {
+      starts = 0;
+    } else {
+      starts = S_block_starts[peek_at(input, parser->first_nonspace)];
+      if (!starts)
+        break;
+    }
 
-    if (!indented && peek_at(input, parser->first_nonspace) == '>') {
+    if (starts & BLOCK_START_QUOTE) {
 
       bufsize_t blockquote_startpos = parser->first_nonspace;
 
@@ -1007,8 +2142,9 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       *container = add_child(parser, *container, CMARK_NODE_BLOCK_QUOTE,
                              blockquote_startpos + 1);
 
-    } else if (!indented && (matched = scan_atx_heading_start(
-                                 input, parser->first_nonspace))) {
+    } else if ((starts & BLOCK_START_ATX) &&
+               (matched = scan_atx_heading_start(S_scannable(parser, input),
+                                                 parser->first_nonspace))) {
       bufsize_t hashpos;
       int level = 0;
       bufsize_t heading_startpos = parser->first_nonspace;
@@ -1030,8 +2166,9 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       (*container)->as.heading.setext = false;
       (*container)->as.heading.internal_offset = matched;
 
-    } else if (!indented && (matched = scan_open_code_fence(
-                                 input, parser->first_nonspace))) {
+    } else if ((starts & BLOCK_START_FENCE) &&
+               (matched = scan_open_code_fence(S_scannable(parser, input),
+                                               parser->first_nonspace))) {
       *container = add_child(parser, *container, CMARK_NODE_CODE_BLOCK,
                              parser->first_nonspace + 1);
       (*container)->as.code.fenced = true;
@@ -1044,22 +2181,24 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
                        parser->first_nonspace + matched - parser->offset,
                        false);
 
-    } else if (!indented && ((matched = scan_html_block_start(
-                                  input, parser->first_nonspace)) ||
-                             (cont_type != CMARK_NODE_PARAGRAPH &&
-                              !maybe_lazy &&
-                              (matched = scan_html_block_start_7(
-                                   input, parser->first_nonspace))))) {
+    } else if ((starts & BLOCK_START_HTML) &&
+               ((matched = scan_html_block_start(S_scannable(parser, input),
+                                                 parser->first_nonspace)) ||
+                (cont_type != CMARK_NODE_PARAGRAPH && !maybe_lazy &&
+                 (matched = scan_html_block_start_7(
+                      input, parser->first_nonspace))))) {
       *container = add_child(parser, *container, CMARK_NODE_HTML_BLOCK,
                              parser->first_nonspace + 1);
       (*container)->as.html_block_type = matched;
       // note, we don't adjust parser->offset because the tag is part of the
       // text
-    } else if (!indented && cont_type == CMARK_NODE_PARAGRAPH &&
-               (lev =
-                    scan_setext_heading_line(input, parser->first_nonspace))) {
+    } else if ((starts & BLOCK_START_SETEXT) &&
+               cont_type == CMARK_NODE_PARAGRAPH &&
+               (lev = scan_setext_heading_line(S_scannable(parser, input),
+                                               parser->first_nonspace))) {
       // finalize paragraph, resolving reference links
-      has_content = resolve_reference_link_definitions(parser);
+      has_content =
+          resolve_reference_link_definitions(parser, (*container)->start_line);
 
       if (has_content) {
 
@@ -1068,7 +2207,7 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
         (*container)->as.heading.setext = true;
         S_advance_offset(parser, input, input->len - 1 - parser->offset, false);
       }
-    } else if (!indented &&
+    } else if ((starts & BLOCK_START_BREAK) &&
                !(cont_type == CMARK_NODE_PARAGRAPH && !all_matched) &&
                (parser->thematic_break_kill_pos <= parser->first_nonspace) &&
                S_scan_thematic_break(parser, input, parser->first_nonspace)) {
@@ -1076,8 +2215,7 @@ static void open_new_blocks(cmark_parser *parser, cmark_node **container,
       *container = add_child(parser, *container, CMARK_NODE_THEMATIC_BREAK,
                              parser->first_nonspace + 1);
       S_advance_offset(parser, input, input->len - 1 - parser->offset, false);
-    } else if ((!indented || cont_type == CMARK_NODE_LIST) &&
-               parser->indent < 4 &&
+    } else if ((starts & BLOCK_START_LIST) &&
                (matched = parse_list_marker(
                     parser->mem, input, parser->first_nonspace,
                     (*container)->type == CMARK_NODE_PARAGRAPH, &data))) {
@@ -1213,6 +2351,7 @@ static void add_text_to_container(cmark_parser *parser, cmark_node *container,
       add_line(input, parser);
 
       int matches_end_condition;
+      S_scannable(parser, input);
       switch (container->as.html_block_type) {
       case 1:
         // </script>, </style>, </textarea>, </pre>
@@ -1279,16 +2418,26 @@ static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
   cmark_node *container;
   cmark_chunk input;
 
-  if (parser->options & CMARK_OPT_VALIDATE_UTF8)
-    cmark_utf8proc_check(&parser->curline, buffer, bytes);
-  else
-    cmark_strbuf_put(&parser->curline, buffer, bytes);
+  if (parser->line_src == buffer) {
+    // The line is followed by a newline in the input, which stays valid
+    // while it is processed: use it in place.
+    input.data = buffer;
+    input.len = bytes + 1;
+  } else {
+    if (parser->options & CMARK_OPT_VALIDATE_UTF8)
+      cmark_utf8proc_check(&parser->curline, buffer, bytes);
+    else
+      cmark_strbuf_put(&parser->curline, buffer, bytes);
+
+    bytes = parser->curline.size;
 
-  bytes = parser->curline.size;
+    // ensure line ends with a newline:
+    if (bytes == 0 || !S_is_line_end_char(parser->curline.ptr[bytes - 1]))
+      cmark_strbuf_putc(&parser->curline, '\n');
 
-  // ensure line ends with a newline:
-  if (bytes == 0 || !S_is_line_end_char(parser->curline.ptr[bytes - 1]))
-    cmark_strbuf_putc(&parser->curline, '\n');
+    input.data = parser->curline.ptr;
+    input.len = parser->curline.size;
+  }
 
   parser->offset = 0;
   parser->column = 0;
@@ -1299,9 +2448,7 @@ static void S_process_line(cmark_parser *parser, const unsigned char *buffer,
   parser->blank = false;
   parser->partially_consumed_tab = false;
 
-  input.data = parser->curline.ptr;
-  input.len = parser->curline.size;
-
+  parser->line = input;
   parser->line_number++;
 
   last_matched_container = check_open_blocks(parser, &input, &all_matched);
@@ -1325,19 +2472,31 @@ finished:
     parser->last_line_length -= 1;
 
   cmark_strbuf_clear(&parser->curline);
+  parser->line.data = NULL;
+  parser->line.len = 0;
 }
 
 cmark_node *cmark_parser_finish(cmark_parser *parser) {
-  if (parser->linebuf.size) {
+  if (parser->linebuf.size && !S_over_limit(parser)) {
     S_process_line(parser, parser->linebuf.ptr, parser->linebuf.size);
     cmark_strbuf_clear(&parser->linebuf);
   }
 
   finalize_document(parser);
 
+  parser->root->as.document.source_size = parser->total_size;
+  parser->root->as.document.truncated = parser->truncated;
   cmark_consolidate_text_nodes(parser->root);
 
-  cmark_strbuf_free(&parser->curline);
+  // The document takes the pages its nodes were allocated from, and the
+  // parser starts a new pool for the next one.
+  if (parser->options & CMARK_OPT_COMPACT) {
+    parser->root->as.document.pool = parser->pool;
+    parser->pool = cmark_node_pool_new(parser->mem);
+  }
+
+  cmark_strbuf_clear(&parser->curline);
+  parser->finished = true;
 
 #if CMARK_DEBUG_NODES
   if (cmark_node_check(parser->root, stderr)) {
@@ -28,6 +28,46 @@ extern "C" {
 CMARK_EXPORT
 char *cmark_markdown_to_html(const char *text, size_t len, int options);
 
+/** A document for 'cmark_markdown_to_html_batch': 'len' bytes of
+ * UTF-8 encoded Markdown at 'text'.
+ */
+typedef struct cmark_doc_in {
+  const char *text;
+  size_t len;
+} cmark_doc_in;
+
+/** The result of converting one document in a batch:  a null-terminated
+ * HTML string of length 'len', which the caller has to free, and the
+ * wall-clock time spent parsing and rendering it.
+ */
+typedef struct cmark_doc_out {
+  char *html;
+  size_t len;
+  double seconds;
+} cmark_doc_out;
+
+/** Settings for 'cmark_markdown_to_html_batch':  the options to parse
+ * and render with, and the number of threads to use, or 0 for one per
+ * processor.
+ */
+typedef struct cmark_batch_opts {
+  int options;
+  int nthreads;
+} cmark_batch_opts;
+
+/** Converts the 'n' documents in 'docs' to HTML like
+ * 'cmark_markdown_to_html', storing the result for 'docs[i]' in
+ * 'out[i]'.  The documents are shared out among a pool of threads, each
+ * of which reuses one parser and one output buffer for all the
+ * documents it converts.  'opts' may be NULL for the default options
+ * on one thread per processor.  Returns the number of threads that
+ * were used.
+ */
+CMARK_EXPORT
+int cmark_markdown_to_html_batch(const cmark_doc_in *docs, size_t n,
+                                 cmark_doc_out *out,
+                                 const cmark_batch_opts *opts);
+
 /** ## Node Structure
  */
 
@@ -87,6 +127,7 @@ typedef enum {
 typedef struct cmark_node cmark_node;
 typedef struct cmark_parser cmark_parser;
 typedef struct cmark_iter cmark_iter;
+typedef struct cmark_render_context cmark_render_context;
 
 /**
  * ## Custom memory allocator support
@@ -105,6 +146,73 @@ typedef struct cmark_mem {
  */
 CMARK_EXPORT cmark_mem *cmark_get_default_mem_allocator(void);
 
+/** Returns a pointer to an arena (bump) allocator.  Allocations are
+ * carved out of large chunks and 'free' is a no-op, so a document
+ * parsed with this allocator, along with everything rendered from it,
+ * is released all at once by 'cmark_arena_reset'.  The arena belongs
+ * to the calling thread:  nodes and strings allocated from it must not
+ * be used after that thread resets or releases its arena.
+ *
+ *     cmark_parser *parser = cmark_parser_new_with_mem(
+ *         CMARK_OPT_DEFAULT, cmark_get_arena_mem_allocator());
+ *     cmark_parser_feed(parser, buffer, len);
+ *     cmark_node *doc = cmark_parser_finish(parser);
+ *     char *html = cmark_render_html(doc, CMARK_OPT_DEFAULT);
+ *     // use html
+ *     cmark_arena_reset();
+ */
+CMARK_EXPORT cmark_mem *cmark_get_arena_mem_allocator(void);
+
+/** Releases everything allocated from the calling thread's arena.
+ * One chunk of the standard size (4 MB) is kept for reuse by the next
+ * document; the larger chunks a big document needed are freed.
+ */
+CMARK_EXPORT void cmark_arena_reset(void);
+
+/** Like 'cmark_arena_reset', but also returns the kept chunk to
+ * the system.  Call this before a thread that used the arena exits.
+ */
+CMARK_EXPORT void cmark_arena_release(void);
+
+/** Memory use recorded by a counting allocator, in bytes requested
+ * by cmark (excluding the allocator's own overhead).
+ */
+typedef struct cmark_mem_stats {
+  size_t current;       /* bytes currently allocated */
+  size_t peak;          /* largest value 'current' has reached */
+  size_t allocations;   /* number of new blocks */
+  size_t reallocations; /* number of blocks resized */
+  size_t largest;       /* largest single block */
+} cmark_mem_stats;
+
+/** Returns an allocator that forwards to 'base' and counts what goes
+ * through it, for use with 'cmark_parser_new_with_mem':
+ *
+ *     cmark_mem *mem = cmark_counting_mem_new(
+ *         cmark_get_default_mem_allocator());
+ *     cmark_node *doc = ... // parse and render with 'mem'
+ *     cmark_mem_stats stats = cmark_counting_mem_stats(mem);
+ *
+ * Blocks are resized and freed through the allocator they came from,
+ * but new blocks can only be charged to the counting allocator most
+ * recently created, and not yet freed, by the calling thread.  Counting
+ * allocators on a thread therefore nest:  while a newer one exists, an
+ * older one doesn't see new blocks, and it counts again once the newer
+ * one is freed.  Allocating new blocks on a thread with no counting
+ * allocator aborts.
+ */
+CMARK_EXPORT cmark_mem *cmark_counting_mem_new(cmark_mem *base);
+
+/** Returns the counts recorded so far by a counting allocator.
+ */
+CMARK_EXPORT cmark_mem_stats cmark_counting_mem_stats(cmark_mem *mem);
+
+/** Frees a counting allocator.  Everything allocated from it must
+ * have been freed first, and it must be freed on the thread that
+ * created it.
+ */
+CMARK_EXPORT void cmark_counting_mem_free(cmark_mem *mem);
+
 /**
  * ## Classifying nodes
  */
@@ -122,6 +230,12 @@ CMARK_EXPORT bool cmark_node_is_inline(cmark_node *node);
   */
 CMARK_EXPORT bool cmark_node_is_leaf(cmark_node *node);
 
+/** Returns true if the node is a document that the parser cut short
+ * because it reached its memory limit (see
+ * 'cmark_parser_set_memory_limit').
+  */
+CMARK_EXPORT bool cmark_node_is_truncated(cmark_node *node);
+
 /**
  * ## Creating and Destroying Nodes
  */
@@ -289,9 +403,24 @@ const char *cmark_node_get_type_string(cmark_node *node);
 /** Returns the string contents of 'node', or an empty
     string if none is set.  Returns NULL if called on a
     node that does not have string content.
+
+    If the contents are borrowed from the input (see
+    'CMARK_OPT_BORROW_INPUT'), this copies them into the node to
+    NUL-terminate them, which modifies 'node'.  It must then not be
+    called while another thread reads the same node.  Use
+    'cmark_node_get_literal_with_len' to read the contents without
+    copying them.
  */
 CMARK_EXPORT const char *cmark_node_get_literal(cmark_node *node);
 
+/** Returns the string contents of 'node' and stores their length in
+    '*len', without modifying 'node'.  The contents need not be
+    NUL-terminated.  Returns NULL, with '*len' set to 0, if called on a
+    node that does not have string content.
+ */
+CMARK_EXPORT const char *cmark_node_get_literal_with_len(cmark_node *node,
+                                                         size_t *len);
+
 /** Sets the string contents of 'node'.  Returns 1 on success,
  * 0 on failure.
  */
@@ -521,11 +650,49 @@ CMARK_EXPORT
 cmark_parser *cmark_parser_new_with_mem_into_root(
     int options, cmark_mem *mem, cmark_node *root);
 
+/** Prepares 'parser' for a new document, as if it had just been created
+ * with 'options'.  The buffers and reference map storage of the parser are
+ * kept, so a single parser can be reused for any number of documents
+ * without the cost of setting one up for each.  The parser starts over with
+ * a new document node:  a document previously returned by
+ * 'cmark_parser_finish' is not affected and must still be freed by the
+ * caller, while a document that was not finished yet is discarded.  A
+ * root passed to 'cmark_parser_new_with_mem_into_root' is never freed:
+ * it keeps what was parsed into it so far and stays the caller's.
+ *
+ *     cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+ *     for (i = 0; i < ndocs; i++) {
+ *         cmark_parser_feed(parser, docs[i], lens[i]);
+ *         document = cmark_parser_finish(parser);
+ *         // use document
+ *         cmark_node_free(document);
+ *         cmark_parser_reset(parser, CMARK_OPT_DEFAULT);
+ *     }
+ *     cmark_parser_free(parser);
+ */
+CMARK_EXPORT
+void cmark_parser_reset(cmark_parser *parser, int options);
+
 /** Frees memory allocated for a parser object.
  */
 CMARK_EXPORT
 void cmark_parser_free(cmark_parser *parser);
 
+/** Limits the memory 'parser' uses for a document to about 'limit'
+ * bytes:  its nodes and their text, its line and content buffers and
+ * the reference map.  Once the limit is reached, the parser ignores
+ * further input and 'cmark_parser_finish' returns what was parsed so
+ * far, marked as truncated (see 'cmark_node_is_truncated').  The count
+ * is approximate and can overshoot by about one line of input, or by
+ * the inline text of one paragraph or heading.  Each document is
+ * counted on its own:  documents parsed before 'cmark_parser_reset',
+ * and buffer space the parser kept from them, don't count towards it.
+ * A limit of 0, the default, means no limit.  The limit is kept by
+ * 'cmark_parser_reset'.
+ */
+CMARK_EXPORT
+void cmark_parser_set_memory_limit(cmark_parser *parser, size_t limit);
+
 /** Feeds a string of length 'len' to 'parser'.
  */
 CMARK_EXPORT
@@ -536,6 +703,39 @@ void cmark_parser_feed(cmark_parser *parser, const char *buffer, size_t len);
 CMARK_EXPORT
 cmark_node *cmark_parser_finish(cmark_parser *parser);
 
+/** Parses 'buffer' of length 'len' again after an edit, reusing what
+ * it can of 'document', the tree 'parser' last returned.  The edit
+ * replaced the bytes from 'edit_start' to 'edit_old_end' of the previous
+ * buffer with those from 'edit_start' to 'edit_new_end' of 'buffer'.
+ * Only the top-level blocks from the last one that starts above the
+ * edit, up to where the block structure is the same as before, are
+ * parsed again, along with those whose links may refer to a reference
+ * definition the edit changed.  The other blocks are kept, with their
+ * line numbers adjusted.  The result is the same tree
+ * 'cmark_parse_document' would return.
+ *
+ * The parser takes over 'document', which must not have been modified,
+ * and returns the new tree, which may or may not be the same node.
+ * Where the old tree can't be reused, such as with
+ * CMARK_OPT_BORROW_INPUT or CMARK_OPT_COMPACT, under a memory limit or
+ * if 'document' is NULL, the whole buffer is parsed.
+ *
+ *     cmark_parser *parser = cmark_parser_new(CMARK_OPT_DEFAULT);
+ *     cmark_parser_feed(parser, text, len);
+ *     cmark_node *document = cmark_parser_finish(parser);
+ *     // replace 'old_len' bytes at 'start' with 'new_len' bytes
+ *     document = cmark_parser_reparse(parser, document, text, len,
+ *                                     start, start + old_len,
+ *                                     start + new_len);
+ *     cmark_node_free(document);
+ *     cmark_parser_free(parser);
+ */
+CMARK_EXPORT
+cmark_node *cmark_parser_reparse(cmark_parser *parser, cmark_node *document,
+                                 const char *buffer, size_t len,
+                                 size_t edit_start, size_t edit_old_end,
+                                 size_t edit_new_end);
+
 /** Parse a CommonMark document in 'buffer' of length 'len'.
  * Returns a pointer to a tree of nodes.  The memory allocated for
  * the node tree should be released using 'cmark_node_free'
@@ -544,6 +744,19 @@ cmark_node *cmark_parser_finish(cmark_parser *parser);
 CMARK_EXPORT
 cmark_node *cmark_parse_document(const char *buffer, size_t len, int options);
 
+/** Like 'cmark_parse_document', but parses the inline content of
+ * paragraphs and headings on up to 'nthreads' threads, or one per
+ * processor if 'nthreads' is zero or less.  Documents of a few megabytes
+ * or more are also split at blank lines between top-level blocks, and
+ * the block structure of the pieces is parsed on several threads.  The
+ * resulting tree is the same as that of 'cmark_parse_document'.
+ * Documents with less than a few dozen kilobytes of inline content are
+ * parsed on the calling thread alone.
+ */
+CMARK_EXPORT
+cmark_node *cmark_parse_document_parallel(const char *buffer, size_t len,
+                                          int options, int nthreads);
+
 /** Parse a CommonMark document in file 'f', returning a pointer to
  * a tree of nodes.  The memory allocated for the node tree should be
  * released using 'cmark_node_free' when it is no longer needed.
@@ -568,6 +781,17 @@ char *cmark_render_xml(cmark_node *root, int options);
 CMARK_EXPORT
 char *cmark_render_html(cmark_node *root, int options);
 
+/** Like 'cmark_render_html', but renders the top-level blocks of a
+ * document on up to 'nthreads' threads, or one per processor if
+ * 'nthreads' is zero or less, and joins their output in order.  The
+ * output is the same as that of 'cmark_render_html'.  Documents of less
+ * than a few thousand lines, and documents that were not allocated with
+ * the default allocator, are rendered on the calling thread alone.
+ */
+CMARK_EXPORT
+char *cmark_render_html_parallel(cmark_node *root, int options,
+                                 int nthreads);
+
 /** Render a 'node' tree as a groff man page, without the header.
  * It is the caller's responsibility to free the returned buffer.
  */
@@ -586,6 +810,71 @@ char *cmark_render_commonmark(cmark_node *root, int options, int width);
 CMARK_EXPORT
 char *cmark_render_latex(cmark_node *root, int options, int width);
 
+/**
+ * ## Render contexts
+ *
+ * A render context owns an output buffer that is kept from one render
+ * to the next, so a program rendering many documents reuses the same
+ * memory instead of allocating a fresh string each time.  The buffer
+ * is grown up front from the size of the document's source.
+ *
+ *     cmark_render_context *ctx = cmark_render_context_new(NULL);
+ *     size_t len = cmark_render_context_html(ctx, doc, CMARK_OPT_DEFAULT);
+ *     fwrite(cmark_render_context_output(ctx), 1, len, stdout);
+ *     cmark_render_context_free(ctx);
+ */
+
+/** Creates a new render context allocating with 'mem', or with the
+ * default allocator if 'mem' is NULL.
+ */
+CMARK_EXPORT
+cmark_render_context *cmark_render_context_new(cmark_mem *mem);
+
+/** Frees a render context and its output buffer.
+ */
+CMARK_EXPORT
+void cmark_render_context_free(cmark_render_context *ctx);
+
+/** Renders 'root' as an HTML fragment into the context's buffer,
+ * replacing its previous contents, and returns the length of the output.
+ */
+CMARK_EXPORT
+size_t cmark_render_context_html(cmark_render_context *ctx, cmark_node *root,
+                                 int options);
+
+/** Like 'cmark_render_context_html', rendering XML.
+ */
+CMARK_EXPORT
+size_t cmark_render_context_xml(cmark_render_context *ctx, cmark_node *root,
+                                int options);
+
+/** Like 'cmark_render_context_html', rendering a commonmark document.
+ */
+CMARK_EXPORT
+size_t cmark_render_context_commonmark(cmark_render_context *ctx,
+                                       cmark_node *root, int options,
+                                       int width);
+
+/** Like 'cmark_render_context_html', rendering a LaTeX document.
+ */
+CMARK_EXPORT
+size_t cmark_render_context_latex(cmark_render_context *ctx, cmark_node *root,
+                                  int options, int width);
+
+/** Like 'cmark_render_context_html', rendering a groff man page without
+ * the header.
+ */
+CMARK_EXPORT
+size_t cmark_render_context_man(cmark_render_context *ctx, cmark_node *root,
+                                int options, int width);
+
+/** Returns the output of the last render, NUL-terminated.  The string
+ * belongs to the context and stays valid until the next render or until
+ * the context is freed.
+ */
+CMARK_EXPORT
+const char *cmark_render_context_output(cmark_render_context *ctx);
+
 /**
  * ## Options
  */
@@ -641,6 +930,25 @@ char *cmark_render_latex(cmark_node *root, int options, int width);
  */
 #define CMARK_OPT_SMART (1 << 10)
 
+/** Give the parsed document the pages of memory its nodes were
+ * allocated from, so that freeing the document releases them all at
+ * once rather than node by node.  Nodes of such a document must not be
+ * used after the document itself has been freed, even if they were
+ * unlinked from it.
+ */
+#define CMARK_OPT_COMPACT (1 << 11)
+
+/** Let text, code and HTML nodes refer to the input passed to
+ * 'cmark_parse_document' or 'cmark_parser_feed' instead of copying it,
+ * wherever the node's content appears verbatim in the input.  The
+ * caller must keep the input unchanged for as long as the document
+ * exists.  Has no effect on 'cmark_parse_file'.  Such content isn't
+ * NUL-terminated, so 'cmark_node_get_literal' copies it into the node
+ * on first use, which is unsafe while other threads read the document;
+ * 'cmark_node_get_literal_with_len' reads it in place.
+ */
+#define CMARK_OPT_BORROW_INPUT (1 << 12)
+
 /**
  * ## Version information
  */
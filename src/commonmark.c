@@ -14,6 +14,8 @@
 
 #define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
 #define LIT(s) renderer->out(renderer, s, false, LITERAL)
+#define OUT_LITERAL(n, wrap, escaping)                                         \
+  cmark_render_out(renderer, (const char *)(n)->data, (n)->len, wrap, escaping)
 #define CR() renderer->cr(renderer)
 #define BLANKLINE() renderer->blankline(renderer)
 #define ENCODED_SIZE 20
@@ -73,13 +75,13 @@ static inline void outc(cmark_renderer *renderer, cmark_escaping escape,
   }
 }
 
-static int longest_backtick_sequence(const char *code) {
+static int longest_backtick_sequence(const unsigned char *code,
+                                     size_t code_len) {
   int longest = 0;
   int current = 0;
   size_t i = 0;
-  size_t code_len = strlen(code);
   while (i <= code_len) {
-    if (code[i] == '`') {
+    if (i < code_len && code[i] == '`') {
       current++;
     } else {
       if (current > longest) {
@@ -92,15 +94,15 @@ static int longest_backtick_sequence(const char *code) {
   return longest;
 }
 
-static int shortest_unused_backtick_sequence(const char *code) {
+static int shortest_unused_backtick_sequence(const unsigned char *code,
+                                             size_t code_len) {
   // note: if the shortest sequence is >= 32, this returns 32
   // so as not to overflow the bit array.
   uint32_t used = 1;
   int current = 0;
   size_t i = 0;
-  size_t code_len = strlen(code);
   while (i <= code_len) {
-    if (code[i] == '`') {
+    if (i < code_len && code[i] == '`') {
       current++;
     } else {
       if (current > 0 && current < 32) {
@@ -148,7 +150,8 @@ static bool is_autolink(cmark_node *node) {
     url += 7;
   }
   return link_text->data != NULL &&
-         strcmp((const char *)url, (char *)link_text->data) == 0;
+         strlen((const char *)url) == (size_t)link_text->len &&
+         memcmp(url, link_text->data, link_text->len) == 0;
 }
 
 static int S_render_node(cmark_renderer *renderer, cmark_node *node,
@@ -276,9 +279,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     }
     info = cmark_node_get_fence_info(node);
     fencechar[0] = strchr(info, '`') == NULL ? '`' : '~';
-    code = cmark_node_get_literal(node);
-
-    numticks = longest_backtick_sequence(code) + 1;
+    numticks = longest_backtick_sequence(node->data, node->len) + 1;
     if (numticks < 3) {
       numticks = 3;
     }
@@ -288,7 +289,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     LIT(" ");
     OUT(info, false, LITERAL);
     CR();
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     CR();
     for (i = 0; i < numticks; i++) {
       LIT(fencechar);
@@ -299,7 +300,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 
   case CMARK_NODE_HTML_BLOCK:
     BLANKLINE();
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     BLANKLINE();
     break;
 
@@ -323,7 +324,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_TEXT:
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     break;
 
   case CMARK_NODE_LINEBREAK:
@@ -347,9 +348,9 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_CODE:
-    code = cmark_node_get_literal(node);
-    code_len = strlen(code);
-    numticks = shortest_unused_backtick_sequence(code);
+    code = (const char *)node->data;
+    code_len = node->len;
+    numticks = shortest_unused_backtick_sequence(node->data, node->len);
     has_nonspace = false;
     for (i=0; i < code_len; i++) {
       if (code[i] != ' ') {
@@ -366,7 +367,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     if (extra_spaces) {
       LIT(" ");
     }
-    OUT(cmark_node_get_literal(node), allow_wrap, LITERAL);
+    OUT_LITERAL(node, allow_wrap, LITERAL);
     if (extra_spaces) {
       LIT(" ");
     }
@@ -376,7 +377,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_HTML_INLINE:
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     break;
 
   case CMARK_NODE_CUSTOM_INLINE:
@@ -470,3 +471,10 @@ char *cmark_render_commonmark(cmark_node *root, int options, int width) {
   }
   return cmark_render(root, options, width, outc, S_render_node);
 }
+
+void cmark_render_commonmark_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                                  cmark_node *root, int options, int width) {
+  if (options & CMARK_OPT_HARDBREAKS)
+    width = 0;
+  cmark_render_into(buf, prefix, root, options, width, outc, S_render_node);
+}
@@ -0,0 +1,157 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmark.h"
+#include "thread.h"
+
+/* An allocator that forwards to another one and keeps count of what
+ * passes through it.  Each block is preceded by a header recording its
+ * size and the allocator it is charged to, so that realloc and free can
+ * update the right counts.
+ *
+ * cmark_mem callbacks carry no context pointer, so calloc and
+ * realloc(NULL, ...) are charged to the innermost counting allocator
+ * of the calling thread.  Each thread keeps a stack of the counting
+ * allocators it has created and not yet freed; freeing one takes it off
+ * the stack, so that an older one counts again once the newer ones are
+ * gone.  Allocating on a thread whose stack is empty is an error.
+ */
+
+typedef struct counting_mem {
+  cmark_mem mem; // must be first: callers get a pointer to it
+  cmark_mem *base;
+  cmark_mem_stats stats;
+  struct counting_mem *outer; // next one down the creating thread's stack
+} counting_mem;
+
+// Padded to 16 bytes to keep payloads aligned.
+typedef union {
+  struct {
+    size_t size;
+    counting_mem *owner;
+  } h;
+  unsigned char pad[16];
+} block_header;
+
+// The top of the calling thread's stack of counting allocators.
+static CMARK_THREAD_LOCAL counting_mem *current_counter = NULL;
+
+static void S_fail(const char *msg) {
+  fprintf(stderr, "[cmark] %s, aborting\n", msg);
+  abort();
+}
+
+static void S_charge(counting_mem *c, size_t old_size, size_t new_size) {
+  c->stats.current += new_size - old_size;
+  if (c->stats.current > c->stats.peak)
+    c->stats.peak = c->stats.current;
+  if (new_size > c->stats.largest)
+    c->stats.largest = new_size;
+}
+
+// Returns the allocator that new blocks on this thread are charged to.
+static counting_mem *S_current(void) {
+  if (current_counter == NULL)
+    S_fail("counting allocation on a thread without a counting allocator");
+  return current_counter;
+}
+
+static void *counting_calloc(size_t nmem, size_t size);
+static void *S_new_block(counting_mem *c, size_t size, bool zeroed);
+
+// Allocates from 'base'.  A counting allocator that is the base of
+// another is charged directly, since its callbacks would charge the
+// innermost counting allocator instead.
+static void *S_base_alloc(cmark_mem *base, size_t size, bool zeroed) {
+  if (base->calloc == counting_calloc)
+    return S_new_block((counting_mem *)base, size, zeroed);
+  return zeroed ? base->calloc(1, size) : base->realloc(NULL, size);
+}
+
+static void *S_new_block(counting_mem *c, size_t size, bool zeroed) {
+  block_header *hdr;
+
+  if (size > SIZE_MAX - sizeof(block_header))
+    S_fail("counting allocation failed");
+  hdr = (block_header *)S_base_alloc(c->base, sizeof(block_header) + size,
+                                     zeroed);
+  if (hdr == NULL)
+    S_fail("counting allocation failed");
+  hdr->h.size = size;
+  hdr->h.owner = c;
+  c->stats.allocations++;
+  S_charge(c, 0, size);
+  return hdr + 1;
+}
+
+static void *counting_calloc(size_t nmem, size_t size) {
+  counting_mem *c = S_current();
+  if (size && nmem > SIZE_MAX / size)
+    S_fail("counting allocation failed");
+  return S_new_block(c, nmem * size, true);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+  block_header *hdr;
+  counting_mem *owner;
+  size_t old_size;
+
+  if (ptr == NULL)
+    return S_new_block(S_current(), size, false);
+  if (size > SIZE_MAX - sizeof(block_header))
+    S_fail("counting allocation failed");
+
+  hdr = (block_header *)ptr - 1;
+  owner = hdr->h.owner;
+  old_size = hdr->h.size;
+  hdr = (block_header *)owner->base->realloc(hdr, sizeof(block_header) + size);
+  if (hdr == NULL)
+    S_fail("counting allocation failed");
+  hdr->h.size = size;
+  owner->stats.reallocations++;
+  S_charge(owner, old_size, size);
+  return hdr + 1;
+}
+
+static void counting_free(void *ptr) {
+  block_header *hdr;
+  counting_mem *owner;
+
+  if (ptr == NULL)
+    return;
+  hdr = (block_header *)ptr - 1;
+  owner = hdr->h.owner;
+  owner->stats.current -= hdr->h.size;
+  owner->base->free(hdr);
+}
+
+cmark_mem *cmark_counting_mem_new(cmark_mem *base) {
+  counting_mem *c =
+      (counting_mem *)S_base_alloc(base, sizeof(counting_mem), true);
+  c->mem.calloc = counting_calloc;
+  c->mem.realloc = counting_realloc;
+  c->mem.free = counting_free;
+  c->base = base;
+  c->outer = current_counter;
+  current_counter = c;
+  return &c->mem;
+}
+
+cmark_mem_stats cmark_counting_mem_stats(cmark_mem *mem) {
+  return ((counting_mem *)mem)->stats;
+}
+
+void cmark_counting_mem_free(cmark_mem *mem) {
+  counting_mem *c = (counting_mem *)mem;
+  counting_mem **link = &current_counter;
+
+  while (*link != c) {
+    if (*link == NULL)
+      S_fail("counting allocator freed on a thread that didn't create it");
+    link = &(*link)->outer;
+  }
+  *link = c->outer;
+  c->base->free(c);
+}
@@ -18,41 +18,27 @@
 #define likely(e) __builtin_expect((e), 1)
 #define unlikely(e) __builtin_expect((e), 0)
 
-/* Binary tree lookup code for entities added by JGM */
-
-static const unsigned char *S_lookup(int i, int low, int hi,
-                                     const unsigned char *s, int len,
-                                     bufsize_t *size_out) {
-  int j;
-  uint32_t value = cmark_entities[i];
-  const unsigned char *ent_name = cmark_entity_text + ENT_TEXT_IDX(value);
-  int ent_len = ENT_NAME_SIZE(value);
-  int min_len = len < ent_len ? len : ent_len;
-  int cmp =
-      strncmp((const char *)s, (const char *)ent_name, min_len);
-  if (cmp == 0)
-    cmp = len - ent_len;
-  if (cmp == 0) {
-    *size_out = ENT_REPL_SIZE(value);
-    return ent_name + ent_len;
-  } else if (cmp <= 0 && i > low) {
-    j = i - ((i - low) / 2);
-    if (j == i)
-      j -= 1;
-    return S_lookup(j, low, i - 1, s, len, size_out);
-  } else if (cmp > 0 && i < hi) {
-    j = i + ((hi - i) / 2);
-    if (j == i)
-      j += 1;
-    return S_lookup(j, i + 1, hi, s, len, size_out);
-  } else {
-    return NULL;
-  }
-}
-
+// Looks up an entity name in the perfect hash table generated by
+// tools/make_entities_inc.py, which must hash names the same way.
 static const unsigned char *S_lookup_entity(const unsigned char *s, int len,
                                             bufsize_t *size_out) {
-  return S_lookup(ENT_TABLE_SIZE / 2, 0, ENT_TABLE_SIZE - 1, s, len, size_out);
+  uint64_t h = UINT64_C(0xCBF29CE484222325);
+  uint32_t value;
+  uint16_t d;
+  int i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ s[i]) * UINT64_C(0x100000001B3);
+
+  d = cmark_entity_displacements[(h * ENT_HASH_MUL) >> (64 - ENT_BUCKET_BITS)];
+  value = cmark_entities[(uint32_t)(((h ^ d) * ENT_HASH_MUL) >> 32) %
+                         ENT_TABLE_SIZE];
+  if ((int)ENT_NAME_SIZE(value) != len ||
+      memcmp(s, cmark_entity_text + ENT_TEXT_IDX(value), len) != 0)
+    return NULL;
+
+  *size_out = ENT_REPL_SIZE(value);
+  return cmark_entity_text + ENT_TEXT_IDX(value) + len;
 }
 
 bufsize_t houdini_unescape_ent(cmark_strbuf *ob, const uint8_t *src,
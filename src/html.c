@@ -9,7 +9,9 @@
 #include "node.h"
 #include "buffer.h"
 #include "houdini.h"
+#include "render.h"
 #include "scanners.h"
+#include "thread.h"
 
 #define BUFFER_SIZE 100
 
@@ -326,20 +328,116 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
   return 1;
 }
 
-char *cmark_render_html(cmark_node *root, int options) {
-  char *result;
-  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+void cmark_render_html_into(cmark_strbuf *html, cmark_node *root,
+                            int options) {
   cmark_event_type ev_type;
   cmark_node *cur;
-  struct render_state state = {&html, NULL};
+  struct render_state state = {html, NULL};
   cmark_iter *iter = cmark_iter_new(root);
 
   while ((ev_type = cmark_iter_next(iter)) != CMARK_EVENT_DONE) {
     cur = cmark_iter_get_node(iter);
     S_render_node(cur, ev_type, &state, options);
   }
-  result = (char *)cmark_strbuf_detach(&html);
 
   cmark_iter_free(iter);
-  return result;
+}
+
+char *cmark_render_html(cmark_node *root, int options) {
+  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+  cmark_render_html_into(&html, root, options);
+  return (char *)cmark_strbuf_detach(&html);
+}
+
+// Top-level blocks are handed to the threads in runs spanning at least
+// this many lines of the source.
+#define RENDER_TASK_LINES 1024
+
+typedef struct {
+  cmark_node **blocks;
+  size_t *tasks; // task i renders blocks tasks[i] to tasks[i + 1] - 1
+  cmark_strbuf *out;
+  int options;
+} render_job;
+
+static void S_render_task(void *ctx, size_t task, int worker) {
+  render_job *job = (render_job *)ctx;
+  size_t i;
+
+  (void)worker;
+  for (i = job->tasks[task]; i < job->tasks[task + 1]; i++)
+    cmark_render_html_into(&job->out[task], job->blocks[i], job->options);
+}
+
+// Top-level blocks only depend on each other through cr(), which looks
+// at the last byte of the output so far.  Every block leaves the output
+// empty or ending in a newline, and cr() treats the two alike, so each
+// run of blocks renders the same on its own as after the runs before it.
+char *cmark_render_html_parallel(cmark_node *root, int options,
+                                 int nthreads) {
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  cmark_strbuf html = CMARK_BUF_INIT(root->mem);
+  cmark_node **blocks;
+  cmark_node *cur;
+  size_t nblocks = 0, ntasks = 0, lines = 0, task_lines, size = 0, i;
+  render_job job;
+
+  if (nthreads <= 0)
+    nthreads = cmark_thread_count();
+  if (nthreads < 2 || root->type != CMARK_NODE_DOCUMENT ||
+      root->mem != mem || root->first_child == root->last_child)
+    return cmark_render_html(root, options);
+
+  for (cur = root->first_child; cur; cur = cur->next)
+    nblocks++;
+  blocks = (cmark_node **)mem->calloc(nblocks, sizeof(*blocks));
+  nblocks = 0;
+  for (cur = root->first_child; cur; cur = cur->next) {
+    blocks[nblocks++] = cur;
+    lines += cur->end_line > cur->start_line
+                 ? (size_t)(cur->end_line - cur->start_line) + 1
+                 : 1;
+  }
+
+  task_lines = lines / ((size_t)nthreads * 4);
+  if (task_lines < RENDER_TASK_LINES)
+    task_lines = RENDER_TASK_LINES;
+  if (lines < 2 * task_lines) {
+    mem->free(blocks);
+    return cmark_render_html(root, options);
+  }
+
+  job.blocks = blocks;
+  job.options = options;
+  job.tasks = (size_t *)mem->calloc(nblocks + 1, sizeof(size_t));
+  for (i = 0; i < nblocks; i++) {
+    cur = blocks[i];
+    size += cur->end_line > cur->start_line
+                ? (size_t)(cur->end_line - cur->start_line) + 1
+                : 1;
+    if (size >= task_lines || i + 1 == nblocks) {
+      job.tasks[++ntasks] = i + 1;
+      size = 0;
+    }
+  }
+  job.out = (cmark_strbuf *)mem->calloc(ntasks, sizeof(cmark_strbuf));
+  for (i = 0; i < ntasks; i++)
+    cmark_strbuf_init(mem, &job.out[i], 0);
+
+  cmark_run_tasks(S_render_task, &job, ntasks, nthreads);
+
+  size = 0;
+  for (i = 0; i < ntasks; i++)
+    size += (size_t)job.out[i].size;
+  if (size <= INT32_MAX / 2)
+    cmark_strbuf_grow(&html, (bufsize_t)size);
+  for (i = 0; i < ntasks; i++) {
+    cmark_strbuf_put(&html, job.out[i].ptr, job.out[i].size);
+    cmark_strbuf_free(&job.out[i]);
+  }
+
+  mem->free(job.out);
+  mem->free(job.tasks);
+  mem->free(blocks);
+  return (char *)cmark_strbuf_detach(&html);
 }
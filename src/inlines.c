@@ -12,6 +12,8 @@
 #include "utf8.h"
 #include "scanners.h"
 #include "inlines.h"
+#include "simd.h"
+#include "structural.h"
 
 static const char *EMDASH = "\xE2\x80\x94";
 static const char *ENDASH = "\xE2\x80\x93";
@@ -22,10 +24,10 @@ static const char *LEFTSINGLEQUOTE = "\xE2\x80\x98";
 static const char *RIGHTSINGLEQUOTE = "\xE2\x80\x99";
 
 // Macros for creating various kinds of simple.
-#define make_linebreak(mem) make_simple(mem, CMARK_NODE_LINEBREAK)
-#define make_softbreak(mem) make_simple(mem, CMARK_NODE_SOFTBREAK)
-#define make_emph(mem) make_simple(mem, CMARK_NODE_EMPH)
-#define make_strong(mem) make_simple(mem, CMARK_NODE_STRONG)
+#define make_linebreak(subj) make_simple(subj, CMARK_NODE_LINEBREAK)
+#define make_softbreak(subj) make_simple(subj, CMARK_NODE_SOFTBREAK)
+#define make_emph(subj) make_simple(subj, CMARK_NODE_EMPH)
+#define make_strong(subj) make_simple(subj, CMARK_NODE_STRONG)
 
 #define MAXBACKTICKS 1000
 
@@ -40,6 +42,51 @@ typedef struct delimiter {
   bool can_close;
 } delimiter;
 
+// Bytes that may start something other than plain text:
+// "\r\n\\`&_*[]<!"
+static const int8_t SPECIAL_CHARS[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 1,
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// The same with the smart punctuation characters " ' . - added.
+static const int8_t SMART_SPECIAL_CHARS[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 1, 1, 0, 0, 1, 0, 0, 1, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 1,
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// The two tables above as nibble sets for the vector kernels.  The high
+// nibbles 0, 2, 3, 5 and 6 are bits 0x01, 0x02, 0x04, 0x08 and 0x10;
+// lo[] has, for each low nibble, the bits of the high nibbles it
+// combines with.  E.g. lo[0xa] is 0x01 | 0x02 for '\n' and '*'.
+static const cmark_byte_set SPECIAL_SET = {
+    {0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03, 0x08,
+     0x0c, 0x09, 0x00, 0x08},
+    {0x01, 0x00, 0x02, 0x04, 0x00, 0x08, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00}};
+
+static const cmark_byte_set SMART_SPECIAL_SET = {
+    {0x10, 0x02, 0x02, 0x00, 0x00, 0x00, 0x02, 0x02, 0x00, 0x00, 0x03, 0x08,
+     0x0c, 0x0b, 0x02, 0x08},
+    {0x01, 0x00, 0x02, 0x04, 0x00, 0x08, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00}};
+
 typedef struct bracket {
   struct bracket *previous;
   cmark_node *inl_text;
@@ -56,6 +103,7 @@ typedef struct bracket {
 
 typedef struct {
   cmark_mem *mem;
+  cmark_node_pool *pool;
   cmark_chunk input;
   unsigned flags;
   int line;
@@ -68,6 +116,17 @@ typedef struct {
   bufsize_t backticks[MAXBACKTICKS + 1];
   bool scanned_for_backticks;
   bool no_link_openers;
+  const unsigned char *borrowed; // the input as the parent borrows it
+  cmark_strbuf *scratch; // NUL-terminated copy of a borrowed input
+  bool borrow; // nodes may point into the borrowed input
+  // Where a run of plain text ends; see subject_find_special_char.
+  const int8_t *special_chars;
+  const cmark_byte_set *special_set;
+  cmark_simd_skip_fn skip_special;
+  // If the input is a span of an indexed document, the document's
+  // special-character bitmap and where the span starts in it.
+  const uint64_t *special_bits;
+  bufsize_t special_base;
 } subject;
 
 static inline bool S_is_line_end_char(char c) {
@@ -81,13 +140,21 @@ static int parse_inline(subject *subj, cmark_node *parent, int options);
 
 static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset, subject *e,
                              cmark_chunk *chunk, cmark_reference_map *refmap);
-static bufsize_t subject_find_special_char(subject *subj, int options);
+static bufsize_t subject_find_special_char(subject *subj);
+
+static inline cmark_node *alloc_node(subject *subj) {
+  cmark_node *e;
+  if (subj->pool)
+    return cmark_node_pool_alloc(subj->pool, subj->mem);
+  e = (cmark_node *)subj->mem->calloc(1, sizeof(*e));
+  e->mem = subj->mem;
+  return e;
+}
 
 // Create an inline with a literal string value.
 static inline cmark_node *make_literal(subject *subj, cmark_node_type t,
                                        int start_column, int end_column) {
-  cmark_node *e = (cmark_node *)subj->mem->calloc(1, sizeof(*e));
-  e->mem = subj->mem;
+  cmark_node *e = alloc_node(subj);
   e->type = (uint16_t)t;
   e->start_line = e->end_line = subj->line;
   // columns are 1 based.
@@ -97,15 +164,40 @@ static inline cmark_node *make_literal(subject *subj, cmark_node_type t,
 }
 
 // Create an inline with no value.
-static inline cmark_node *make_simple(cmark_mem *mem, cmark_node_type t) {
-  cmark_node *e = (cmark_node *)mem->calloc(1, sizeof(*e));
-  e->mem = mem;
+static inline cmark_node *make_simple(subject *subj, cmark_node_type t) {
+  cmark_node *e = alloc_node(subj);
   e->type = t;
   return e;
 }
 
+// Returns where 'p', a pointer into the input, is in the borrowed input.
+static inline unsigned char *S_borrowed_ptr(subject *subj,
+                                            const unsigned char *p) {
+  return (unsigned char *)subj->borrowed + (p - subj->input.data);
+}
+
+// The re2c scanners need a NUL after the input.  A borrowed input
+// doesn't have one, so it is replaced by a copy before the first
+// scanner call.
+static cmark_chunk *S_scan_input(subject *subj) {
+  if (subj->borrowed && subj->input.data == subj->borrowed) {
+    cmark_strbuf_set(subj->scratch, subj->input.data, subj->input.len);
+    subj->input.data = subj->scratch->ptr;
+  }
+  return &subj->input;
+}
+
 static cmark_node *make_str(subject *subj, int sc, int ec, cmark_chunk s) {
   cmark_node *e = make_literal(subj, CMARK_NODE_TEXT, sc, ec);
+  if (subj->borrow && s.data >= subj->input.data &&
+      s.data + s.len <= subj->input.data + subj->input.len) {
+    e->data = S_borrowed_ptr(subj, s.data);
+    e->len = s.len;
+    e->flags |= CMARK_NODE__BORROWED;
+    return e;
+  }
+  if (cmark_node__set_short_literal(e, s.data, s.len))
+    return e;
   e->data = (unsigned char *)subj->mem->realloc(NULL, s.len + 1);
   if (s.data != NULL) {
     memcpy(e->data, s.data, s.len);
@@ -182,7 +274,7 @@ static unsigned char *cmark_clean_autolink(cmark_mem *mem, cmark_chunk *url,
 static inline cmark_node *make_autolink(subject *subj, int start_column,
                                         int end_column, cmark_chunk url,
                                         int is_email) {
-  cmark_node *link = make_simple(subj->mem, CMARK_NODE_LINK);
+  cmark_node *link = make_simple(subj, CMARK_NODE_LINK);
   link->as.link.url = cmark_clean_autolink(subj->mem, &url, is_email);
   link->as.link.title = NULL;
   link->start_line = link->end_line = subj->line;
@@ -196,6 +288,7 @@ static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset,
                              cmark_chunk *chunk, cmark_reference_map *refmap) {
   int i;
   e->mem = mem;
+  e->pool = NULL;
   e->input = *chunk;
   e->flags = 0;
   e->line = line_number;
@@ -209,7 +302,15 @@ static void subject_from_buf(cmark_mem *mem, int line_number, int block_offset,
     e->backticks[i] = 0;
   }
   e->scanned_for_backticks = false;
+  e->borrowed = NULL;
+  e->scratch = NULL;
+  e->borrow = false;
   e->no_link_openers = true;
+  e->special_chars = SPECIAL_CHARS;
+  e->special_set = &SPECIAL_SET;
+  e->skip_special = cmark_simd_skipper();
+  e->special_bits = NULL;
+  e->special_base = 0;
 }
 
 static inline int isbacktick(int c) { return (c == '`'); }
@@ -392,6 +493,28 @@ static void S_normalize_code(cmark_strbuf *s) {
 }
 
 
+// Like S_normalize_code, but narrows 'code' instead of copying it.
+// Returns false if the code span contains line endings, which need to
+// be rewritten.
+static bool S_normalize_code_slice(cmark_chunk *code) {
+  bool contains_nonspace = false;
+  bufsize_t i;
+
+  for (i = 0; i < code->len; ++i) {
+    if (S_is_line_end_char(code->data[i]))
+      return false;
+    if (code->data[i] != ' ')
+      contains_nonspace = true;
+  }
+
+  if (contains_nonspace && code->data[0] == ' ' &&
+      code->data[code->len - 1] == ' ') {
+    code->data += 1;
+    code->len -= 2;
+  }
+  return true;
+}
+
 // Parse backtick code section or raw backticks, return an inline.
 // Assumes that the subject has a backtick at the current position.
 static cmark_node *handle_backticks(subject *subj, int options) {
@@ -404,16 +527,24 @@ static cmark_node *handle_backticks(subject *subj, int options) {
     subj->pos = startpos; // rewind
     return make_str(subj, initpos, initpos + openticks.len - 1, openticks);
   } else {
-    cmark_strbuf buf = CMARK_BUF_INIT(subj->mem);
-
-    cmark_strbuf_set(&buf, subj->input.data + startpos,
-                     endpos - startpos - openticks.len);
-    S_normalize_code(&buf);
-
+    cmark_chunk code = cmark_chunk_dup(&subj->input, startpos,
+                                       endpos - startpos - openticks.len);
     cmark_node *node = make_literal(subj, CMARK_NODE_CODE, startpos,
                                     endpos - openticks.len - 1);
-    node->len = buf.size;
-    node->data = cmark_strbuf_detach(&buf);
+
+    if (subj->borrow && S_normalize_code_slice(&code)) {
+      node->data = S_borrowed_ptr(subj, code.data);
+      node->len = code.len;
+      node->flags |= CMARK_NODE__BORROWED;
+    } else if (code.len >= CMARK_NODE__LITERAL_SIZE ||
+               !S_normalize_code_slice(&code) ||
+               !cmark_node__set_short_literal(node, code.data, code.len)) {
+      cmark_strbuf buf = CMARK_BUF_INIT(subj->mem);
+      cmark_strbuf_set(&buf, code.data, code.len);
+      S_normalize_code(&buf);
+      node->len = buf.size;
+      node->data = cmark_strbuf_detach(&buf);
+    }
     adjust_subj_node_newlines(subj, node, endpos - startpos, openticks.len, options);
     return node;
   }
@@ -769,10 +900,12 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
   opener_num_chars -= use_delims;
   closer_num_chars -= use_delims;
   opener_inl->len = opener_num_chars;
-  opener_inl->data[opener_num_chars] = 0;
+  if (!(opener_inl->flags & CMARK_NODE__BORROWED))
+    opener_inl->data[opener_num_chars] = 0;
   opener_inl->end_column -= use_delims;
   closer_inl->len = closer_num_chars;
-  closer_inl->data[closer_num_chars] = 0;
+  if (!(closer_inl->flags & CMARK_NODE__BORROWED))
+    closer_inl->data[closer_num_chars] = 0;
   closer_inl->start_column += use_delims;
 
   // free delimiters between opener and closer
@@ -785,7 +918,7 @@ static delimiter *S_insert_emph(subject *subj, delimiter *opener,
 
   // create new emph or strong, and splice it in to our inlines
   // between the opener and closer
-  emph = use_delims == 1 ? make_emph(subj->mem) : make_strong(subj->mem);
+  emph = use_delims == 1 ? make_emph(subj) : make_strong(subj);
 
   tmp = opener_inl->next;
   if (tmp && tmp != closer_inl) {
@@ -842,7 +975,7 @@ static cmark_node *handle_backslash(subject *subj) {
     advance(subj);
     return make_str(subj, subj->pos - 2, subj->pos - 1, cmark_chunk_dup(&subj->input, subj->pos - 1, 1));
   } else if (!is_eof(subj) && skip_line_end(subj)) {
-    return make_linebreak(subj->mem);
+    return make_linebreak(subj);
   } else {
     return make_str(subj, subj->pos - 1, subj->pos - 1, cmark_chunk_literal("\\"));
   }
@@ -911,7 +1044,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
   advance(subj); // advance past first <
 
   // first try to match a URL autolink
-  matchlen = scan_autolink_uri(&subj->input, subj->pos);
+  matchlen = scan_autolink_uri(S_scan_input(subj), subj->pos);
   if (matchlen > 0) {
     contents = cmark_chunk_dup(&subj->input, subj->pos, matchlen - 1);
     subj->pos += matchlen;
@@ -920,7 +1053,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
   }
 
   // next try to match an email autolink
-  matchlen = scan_autolink_email(&subj->input, subj->pos);
+  matchlen = scan_autolink_email(S_scan_input(subj), subj->pos);
   if (matchlen > 0) {
     contents = cmark_chunk_dup(&subj->input, subj->pos, matchlen - 1);
     subj->pos += matchlen;
@@ -942,7 +1075,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
                    subj->input.data[subj->pos+4] == '>') {
           matchlen = 5;
         } else {
-          matchlen = scan_html_comment(&subj->input, subj->pos + 1);
+          matchlen = scan_html_comment(S_scan_input(subj), subj->pos + 1);
           if (matchlen > 0) {
             matchlen += 1; // prefix "<"
 	  } else { // no match through end of input: set a flag so
@@ -952,7 +1085,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
 	}
       } else if (c == '[') {
         if ((subj->flags & FLAG_SKIP_HTML_CDATA) == 0) {
-          matchlen = scan_html_cdata(&subj->input, subj->pos + 2);
+          matchlen = scan_html_cdata(S_scan_input(subj), subj->pos + 2);
           if (matchlen > 0) {
             // The regex doesn't require the final "]]>". But if we're not at
             // the end of input, it must come after the match. Otherwise,
@@ -965,7 +1098,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
           }
         }
       } else if ((subj->flags & FLAG_SKIP_HTML_DECLARATION) == 0) {
-        matchlen = scan_html_declaration(&subj->input, subj->pos + 1);
+        matchlen = scan_html_declaration(S_scan_input(subj), subj->pos + 1);
         if (matchlen > 0) {
           matchlen += 2; // prefix "!", suffix ">"
           if (subj->pos + matchlen > subj->input.len) {
@@ -977,7 +1110,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
     } else if (c == '?') {
       if ((subj->flags & FLAG_SKIP_HTML_PI) == 0) {
         // Note that we allow an empty match.
-        matchlen = scan_html_pi(&subj->input, subj->pos + 1);
+        matchlen = scan_html_pi(S_scan_input(subj), subj->pos + 1);
         matchlen += 3; // prefix "?", suffix "?>"
         if (subj->pos + matchlen > subj->input.len) {
           subj->flags |= FLAG_SKIP_HTML_PI;
@@ -985,7 +1118,7 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
         }
       }
     } else {
-      matchlen = scan_html_tag(&subj->input, subj->pos);
+      matchlen = scan_html_tag(S_scan_input(subj), subj->pos);
     }
   }
   if (matchlen > 0) {
@@ -994,9 +1127,14 @@ static cmark_node *handle_pointy_brace(subject *subj, int options) {
     subj->pos += matchlen;
     cmark_node *node = make_literal(subj, CMARK_NODE_HTML_INLINE,
                                     subj->pos - matchlen - 1, subj->pos - 1);
-    node->data = (unsigned char *)subj->mem->realloc(NULL, len + 1);
-    memcpy(node->data, src, len);
-    node->data[len] = 0;
+    if (subj->borrow) {
+      node->data = S_borrowed_ptr(subj, src);
+      node->flags |= CMARK_NODE__BORROWED;
+    } else if (!cmark_node__set_short_literal(node, src, len)) {
+      node->data = (unsigned char *)subj->mem->realloc(NULL, len + 1);
+      memcpy(node->data, src, len);
+      node->data[len] = 0;
+    }
     node->len = len;
     adjust_subj_node_newlines(subj, node, matchlen, 1, options);
     return node;
@@ -1162,20 +1300,20 @@ static cmark_node *handle_close_bracket(subject *subj) {
 
   // First, look for an inline link.
   if (peek_char(subj) == '(' &&
-      ((sps = scan_spacechars(&subj->input, subj->pos + 1)) > -1) &&
+      ((sps = scan_spacechars(S_scan_input(subj), subj->pos + 1)) > -1) &&
       ((n = manual_scan_link_url(&subj->input, subj->pos + 1 + sps,
                                  &url_chunk)) > -1)) {
 
     // try to parse an explicit link:
     endurl = subj->pos + 1 + sps + n;
-    starttitle = endurl + scan_spacechars(&subj->input, endurl);
+    starttitle = endurl + scan_spacechars(S_scan_input(subj), endurl);
 
     // ensure there are spaces btw url and title
     endtitle = (starttitle == endurl)
                    ? starttitle
-                   : starttitle + scan_link_title(&subj->input, starttitle);
+                   : starttitle + scan_link_title(S_scan_input(subj), starttitle);
 
-    endall = endtitle + scan_spacechars(&subj->input, endtitle);
+    endall = endtitle + scan_spacechars(S_scan_input(subj), endtitle);
 
     if (peek_at(subj, endall) == ')') {
       subj->pos = endall + 1;
@@ -1231,7 +1369,7 @@ noMatch:
   return make_str(subj, subj->pos - 1, subj->pos - 1, cmark_chunk_literal("]"));
 
 match:
-  inl = make_simple(subj->mem, is_image ? CMARK_NODE_IMAGE : CMARK_NODE_LINK);
+  inl = make_simple(subj, is_image ? CMARK_NODE_IMAGE : CMARK_NODE_LINK);
   inl->as.link.url = url;
   inl->as.link.title = title;
   inl->start_line = inl->end_line = subj->line;
@@ -1280,48 +1418,40 @@ static cmark_node *handle_newline(subject *subj) {
   skip_spaces(subj);
   if (nlpos > 1 && peek_at(subj, nlpos - 1) == ' ' &&
       peek_at(subj, nlpos - 2) == ' ') {
-    return make_linebreak(subj->mem);
+    return make_linebreak(subj);
   } else {
-    return make_softbreak(subj->mem);
+    return make_softbreak(subj);
   }
 }
 
-static bufsize_t subject_find_special_char(subject *subj, int options) {
-  // "\r\n\\`&_*[]<!"
-  static const int8_t SPECIAL_CHARS[256] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 1,
-      1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-  // " ' . -
-  static const char SMART_PUNCT_CHARS[] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 1, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  };
-
+static bufsize_t subject_find_special_char(subject *subj) {
+  const unsigned char *data = subj->input.data;
+  const int8_t *special = subj->special_chars;
   bufsize_t n = subj->pos + 1;
 
+  if (subj->special_bits) {
+    bufsize_t base = subj->special_base;
+
+    // The bitmap was built from the same set as the vector kernels use,
+    // which can be wider than the table.
+    while (n < subj->input.len) {
+      n = cmark_structural_next(subj->special_bits, base + n,
+                                base + subj->input.len) -
+          base;
+      if (n < subj->input.len && special[data[n]])
+        return n;
+      n++;
+    }
+    return subj->input.len;
+  }
+
+  if (n < subj->input.len)
+    n = (bufsize_t)(subj->skip_special(data + n, data + subj->input.len,
+                                       subj->special_set) -
+                    data);
+
   while (n < subj->input.len) {
-    if (SPECIAL_CHARS[subj->input.data[n]])
-      return n;
-    if (options & CMARK_OPT_SMART && SMART_PUNCT_CHARS[subj->input.data[n]])
+    if (special[data[n]])
       return n;
     n++;
   }
@@ -1388,7 +1518,7 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
     }
     break;
   default:
-    endpos = subject_find_special_char(subj, options);
+    endpos = subject_find_special_char(subj);
     contents = cmark_chunk_dup(&subj->input, subj->pos, endpos - subj->pos);
     startpos = subj->pos;
     subj->pos = endpos;
@@ -1407,18 +1537,48 @@ static int parse_inline(subject *subj, cmark_node *parent, int options) {
   return 1;
 }
 
+const cmark_byte_set *cmark_inline_special_set(int options) {
+  return options & CMARK_OPT_SMART ? &SMART_SPECIAL_SET : &SPECIAL_SET;
+}
+
 // Parse inlines from parent's string_content, adding as children of parent.
-void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
-                         cmark_reference_map *refmap, int options) {
+// If 'node_limit' is not 0, parsing stops early once the pool has that
+// many nodes in use, and false is returned.
+bool cmark_parse_inlines(cmark_mem *mem, cmark_node_pool *pool,
+                         cmark_node *parent, cmark_reference_map *refmap,
+                         int options, cmark_strbuf *scratch,
+                         const cmark_structural_index *index,
+                         size_t node_limit) {
+  bool complete = true;
   int internal_offset = parent->type == CMARK_NODE_HEADING ?
     parent->as.heading.internal_offset : 0;
   subject subj;
   cmark_chunk content = {parent->data, parent->len};
   subject_from_buf(mem, parent->start_line, parent->start_column - 1 + internal_offset, &subj, &content, refmap);
+  subj.pool = pool;
+  if (parent->flags & CMARK_NODE__BORROWED) {
+    // The content may only be borrowed for the duration of the parse.
+    subj.borrowed = parent->data;
+    subj.scratch = scratch;
+    subj.borrow = (options & CMARK_OPT_BORROW_INPUT) != 0;
+    if (index && index->specials && parent->data >= index->input &&
+        parent->data + parent->len <= index->input + index->len) {
+      subj.special_bits = index->specials;
+      subj.special_base = (bufsize_t)(parent->data - index->input);
+    }
+  }
+  if (options & CMARK_OPT_SMART) {
+    subj.special_chars = SMART_SPECIAL_CHARS;
+    subj.special_set = &SMART_SPECIAL_SET;
+  }
   cmark_chunk_rtrim(&subj.input);
 
-  while (!is_eof(&subj) && parse_inline(&subj, parent, options))
-    ;
+  while (!is_eof(&subj) && parse_inline(&subj, parent, options)) {
+    if (node_limit && cmark_node_pool_allocated(pool) >= node_limit) {
+      complete = false;
+      break;
+    }
+  }
 
   process_emphasis(&subj, 0);
   // free bracket and delim stack
@@ -1428,6 +1588,8 @@ void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
   while (subj.last_bracket) {
     pop_bracket(&subj);
   }
+
+  return complete;
 }
 
 // Parse zero or more space characters, including at most one newline.
@@ -1439,11 +1601,12 @@ static void spnl(subject *subj) {
 }
 
 // Parse reference.  Assumes string begins with '[' character.
-// Modify refmap if a reference is encountered.
+// Modify refmap if a reference is encountered, noting that it was
+// defined in the paragraph starting on 'line'.
 // Return 0 if no reference found, otherwise position of subject
 // after reference is parsed.
 bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
-                                       cmark_reference_map *refmap) {
+                                       cmark_reference_map *refmap, int line) {
   subject subj;
 
   cmark_chunk lab;
@@ -1500,6 +1663,6 @@ bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
     }
   }
   // insert reference into refmap
-  cmark_reference_create(refmap, &lab, &url, &title);
+  cmark_reference_create(refmap, &lab, &url, &title, line);
   return subj.pos;
 }
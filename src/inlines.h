@@ -2,7 +2,10 @@
 #define CMARK_INLINES_H
 
 #include "chunk.h"
+#include "node.h"
 #include "references.h"
+#include "simd.h"
+#include "structural.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,11 +14,18 @@ extern "C" {
 unsigned char *cmark_clean_url(cmark_mem *mem, cmark_chunk *url);
 unsigned char *cmark_clean_title(cmark_mem *mem, cmark_chunk *title);
 
-void cmark_parse_inlines(cmark_mem *mem, cmark_node *parent,
-                         cmark_reference_map *refmap, int options);
+bool cmark_parse_inlines(cmark_mem *mem, cmark_node_pool *pool,
+                         cmark_node *parent, cmark_reference_map *refmap,
+                         int options, cmark_strbuf *scratch,
+                         const cmark_structural_index *index,
+                         size_t node_limit);
+
+// The bytes that may start an inline other than text, as a superset for
+// the vector kernels.
+const cmark_byte_set *cmark_inline_special_set(int options);
 
 bufsize_t cmark_parse_reference_inline(cmark_mem *mem, cmark_chunk *input,
-                                       cmark_reference_map *refmap);
+                                       cmark_reference_map *refmap, int line);
 
 #ifdef __cplusplus
 }
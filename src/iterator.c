@@ -100,20 +100,39 @@ void cmark_consolidate_text_nodes(cmark_node *root) {
     cur = cmark_iter_get_node(iter);
     if (ev_type == CMARK_EVENT_ENTER && cur->type == CMARK_NODE_TEXT &&
         cur->next && cur->next->type == CMARK_NODE_TEXT) {
+      // Runs borrowed from adjacent parts of the input can be merged
+      // without copying them.
+      bool contiguous = (cur->flags & CMARK_NODE__BORROWED) != 0;
+      unsigned char *end = cur->data + cur->len;
+      for (tmp = cur->next; contiguous && tmp && tmp->type == CMARK_NODE_TEXT;
+           tmp = tmp->next) {
+        if (!(tmp->flags & CMARK_NODE__BORROWED) || tmp->data != end)
+          contiguous = false;
+        end += tmp->len;
+      }
+
       cmark_strbuf_clear(&buf);
-      cmark_strbuf_put(&buf, cur->data, cur->len);
+      if (!contiguous)
+        cmark_strbuf_put(&buf, cur->data, cur->len);
       tmp = cur->next;
       while (tmp && tmp->type == CMARK_NODE_TEXT) {
         cmark_iter_next(iter); // advance pointer
-        cmark_strbuf_put(&buf, tmp->data, tmp->len);
+        if (!contiguous)
+          cmark_strbuf_put(&buf, tmp->data, tmp->len);
         cur->end_column = tmp->end_column;
         next = tmp->next;
         cmark_node_free(tmp);
         tmp = next;
       }
-      iter->mem->free(cur->data);
-      cur->len = buf.size;
-      cur->data = cmark_strbuf_detach(&buf);
+      if (contiguous) {
+        cur->len = (bufsize_t)(end - cur->data);
+      } else {
+        if (cmark_node__owns_data(cur))
+          iter->mem->free(cur->data);
+        cur->flags &= ~CMARK_NODE__BORROWED;
+        cur->len = buf.size;
+        cur->data = cmark_strbuf_detach(&buf);
+      }
     }
   }
 
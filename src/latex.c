@@ -13,6 +13,8 @@
 
 #define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
 #define LIT(s) renderer->out(renderer, s, false, LITERAL)
+#define OUT_LITERAL(n, wrap, escaping)                                         \
+  cmark_render_out(renderer, (const char *)(n)->data, (n)->len, wrap, escaping)
 #define CR() renderer->cr(renderer)
 #define BLANKLINE() renderer->blankline(renderer)
 #define LIST_NUMBER_STRING_SIZE 20
@@ -318,7 +320,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     CR();
     LIT("\\begin{verbatim}");
     CR();
-    OUT(cmark_node_get_literal(node), false, LITERAL);
+    OUT_LITERAL(node, false, LITERAL);
     CR();
     LIT("\\end{verbatim}");
     BLANKLINE();
@@ -347,7 +349,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_TEXT:
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     break;
 
   case CMARK_NODE_LINEBREAK:
@@ -368,7 +370,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 
   case CMARK_NODE_CODE:
     LIT("\\texttt{");
-    OUT(cmark_node_get_literal(node), false, NORMAL);
+    OUT_LITERAL(node, false, NORMAL);
     LIT("}");
     break;
 
@@ -454,3 +456,8 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 char *cmark_render_latex(cmark_node *root, int options, int width) {
   return cmark_render(root, options, width, outc, S_render_node);
 }
+
+void cmark_render_latex_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                             cmark_node *root, int options, int width) {
+  cmark_render_into(buf, prefix, root, options, width, outc, S_render_node);
+}
@@ -41,36 +41,42 @@ void print_usage(void) {
   printf("  --unsafe         Render raw HTML and dangerous URLs\n");
   printf("  --smart          Use smart punctuation\n");
   printf("  --validate-utf8  Replace invalid UTF-8 sequences with U+FFFD\n");
+  printf("  --compact        Free the document's nodes all at once\n");
+  printf("  --mem-stats      Print memory usage statistics to stderr\n");
+  printf("  --memory-limit BYTES\n"
+         "                   Stop parsing when the document uses about BYTES\n"
+         "                   of memory (default 0 = no limit)\n");
   printf("  --help, -h       Print usage information\n");
   printf("  --version        Print version\n");
 }
 
 static void print_document(cmark_node *document, writer_format writer,
                            int options, int width) {
-  char *result;
+  cmark_render_context *ctx = cmark_render_context_new(document->mem);
+  size_t len;
 
   switch (writer) {
   case FORMAT_HTML:
-    result = cmark_render_html(document, options);
+    len = cmark_render_context_html(ctx, document, options);
     break;
   case FORMAT_XML:
-    result = cmark_render_xml(document, options);
+    len = cmark_render_context_xml(ctx, document, options);
     break;
   case FORMAT_MAN:
-    result = cmark_render_man(document, options, width);
+    len = cmark_render_context_man(ctx, document, options, width);
     break;
   case FORMAT_COMMONMARK:
-    result = cmark_render_commonmark(document, options, width);
+    len = cmark_render_context_commonmark(ctx, document, options, width);
     break;
   case FORMAT_LATEX:
-    result = cmark_render_latex(document, options, width);
+    len = cmark_render_context_latex(ctx, document, options, width);
     break;
   default:
     fprintf(stderr, "Unknown format %d\n", writer);
     exit(1);
   }
-  fwrite(result, strlen(result), 1, stdout);
-  document->mem->free(result);
+  fwrite(cmark_render_context_output(ctx), len, 1, stdout);
+  cmark_render_context_free(ctx);
 }
 
 int main(int argc, char *argv[]) {
@@ -81,9 +87,12 @@ int main(int argc, char *argv[]) {
   size_t bytes;
   cmark_node *document;
   int width = 0;
+  long memory_limit = 0;
   char *unparsed;
   writer_format writer = FORMAT_HTML;
   int options = CMARK_OPT_DEFAULT;
+  cmark_mem *mem = cmark_get_default_mem_allocator();
+  bool mem_stats = false;
 
 #ifdef USE_PLEDGE
   if (pledge("stdio rpath", NULL) != 0) {
@@ -118,10 +127,26 @@ int main(int argc, char *argv[]) {
       options |= CMARK_OPT_UNSAFE;
     } else if (strcmp(argv[i], "--validate-utf8") == 0) {
       options |= CMARK_OPT_VALIDATE_UTF8;
+    } else if (strcmp(argv[i], "--compact") == 0) {
+      options |= CMARK_OPT_COMPACT;
+    } else if (strcmp(argv[i], "--mem-stats") == 0) {
+      mem_stats = true;
     } else if ((strcmp(argv[i], "--help") == 0) ||
                (strcmp(argv[i], "-h") == 0)) {
       print_usage();
       exit(0);
+    } else if (strcmp(argv[i], "--memory-limit") == 0) {
+      i += 1;
+      if (i < argc) {
+        memory_limit = strtol(argv[i], &unparsed, 10);
+        if ((unparsed && unparsed[0]) || memory_limit < 0) {
+          fprintf(stderr, "failed parsing memory limit '%s'\n", argv[i]);
+          exit(1);
+        }
+      } else {
+        fprintf(stderr, "--memory-limit requires an argument\n");
+        exit(1);
+      }
     } else if (strcmp(argv[i], "--width") == 0) {
       i += 1;
       if (i < argc) {
@@ -164,7 +189,11 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  parser = cmark_parser_new(options);
+  if (mem_stats)
+    mem = cmark_counting_mem_new(mem);
+
+  parser = cmark_parser_new_with_mem(options, mem);
+  cmark_parser_set_memory_limit(parser, (size_t)memory_limit);
   for (i = 0; i < numfps; i++) {
     FILE *fp = fopen(argv[files[i]], "rb");
     if (fp == NULL) {
@@ -203,10 +232,24 @@ int main(int argc, char *argv[]) {
   document = cmark_parser_finish(parser);
   cmark_parser_free(parser);
 
+  if (cmark_node_is_truncated(document))
+    fprintf(stderr, "cmark: memory limit reached, output is truncated\n");
+
   print_document(document, writer, options, width);
 
   cmark_node_free(document);
 
+  if (mem_stats) {
+    cmark_mem_stats stats = cmark_counting_mem_stats(mem);
+    fprintf(stderr,
+            "peak=%lu current=%lu allocations=%lu reallocations=%lu "
+            "largest=%lu\n",
+            (unsigned long)stats.peak, (unsigned long)stats.current,
+            (unsigned long)stats.allocations,
+            (unsigned long)stats.reallocations, (unsigned long)stats.largest);
+    cmark_counting_mem_free(mem);
+  }
+
   free(files);
 
   return 0;
@@ -12,6 +12,8 @@
 
 #define OUT(s, wrap, escaping) renderer->out(renderer, s, wrap, escaping)
 #define LIT(s) renderer->out(renderer, s, false, LITERAL)
+#define OUT_LITERAL(n, wrap, escaping)                                         \
+  cmark_render_out(renderer, (const char *)(n)->data, (n)->len, wrap, escaping)
 #define CR() renderer->cr(renderer)
 #define BLANKLINE() renderer->blankline(renderer)
 #define LIST_NUMBER_SIZE 20
@@ -164,7 +166,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
   case CMARK_NODE_CODE_BLOCK:
     CR();
     LIT(".IP\n.nf\n\\f[CR]\n");
-    OUT(cmark_node_get_literal(node), false, NORMAL);
+    OUT_LITERAL(node, false, NORMAL);
     CR();
     LIT("\\f[]\n.fi");
     CR();
@@ -203,7 +205,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
     break;
 
   case CMARK_NODE_TEXT:
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     break;
 
   case CMARK_NODE_LINEBREAK:
@@ -224,7 +226,7 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 
   case CMARK_NODE_CODE:
     LIT("\\f[CR]");
-    OUT(cmark_node_get_literal(node), allow_wrap, NORMAL);
+    OUT_LITERAL(node, allow_wrap, NORMAL);
     LIT("\\f[]");
     break;
 
@@ -279,3 +281,8 @@ static int S_render_node(cmark_renderer *renderer, cmark_node *node,
 char *cmark_render_man(cmark_node *root, int options, int width) {
   return cmark_render(root, options, width, S_outc, S_render_node);
 }
+
+void cmark_render_man_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                           cmark_node *root, int options, int width) {
+  cmark_render_into(buf, prefix, root, options, width, S_outc, S_render_node);
+}
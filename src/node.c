@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -22,6 +23,11 @@ bool cmark_node_is_inline(cmark_node *node) {
          node->type <= CMARK_NODE_LAST_INLINE;
 }
 
+bool cmark_node_is_truncated(cmark_node *node) {
+  return node != NULL && node->type == CMARK_NODE_DOCUMENT &&
+         node->as.document.truncated;
+}
+
 bool cmark_node_is_leaf(cmark_node *node) {
   if (node == NULL) {
     return false;
@@ -117,11 +123,225 @@ cmark_node *cmark_node_new(cmark_node_type type) {
   return cmark_node_new_with_mem(type, &DEFAULT_MEM_ALLOCATOR);
 }
 
+/* A pooled node finds its page from the slot number kept in its flags,
+ * which has room for slots up to POOL_MAX_PAGE (511).  Pages are
+ * therefore capped at that many nodes.  When the pool expects more
+ * nodes than that, it allocates runs of up to POOL_MAX_RUN full pages
+ * at once, laid out back to back in one block.
+ */
+#define POOL_MIN_PAGE 64
+#define POOL_MAX_PAGE (CMARK_NODE__SLOT_MASK >> CMARK_NODE__SLOT_SHIFT)
+#define POOL_MAX_RUN 64
+
+/* Nodes may be freed on any thread, even while the owner of the pool is
+ * allocating from it.  Freed nodes are pushed onto 'remote_free' with a
+ * compare-and-swap, and the owner takes the whole list at once when its
+ * own free list runs dry, so popping never races with pushing.  'refs'
+ * counts the live nodes plus one for the owner; whoever drops it to zero
+ * destroys the pool.
+ */
+#if !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef _Atomic(size_t) pool_count;
+typedef _Atomic(cmark_node *) pool_list;
+#define POOL_ADD(c, n) atomic_fetch_add(c, n)
+#define POOL_SUB(c, n) atomic_fetch_sub(c, n)
+#define POOL_LOAD(c) atomic_load(c)
+#define POOL_TAKE(l) atomic_exchange(l, NULL)
+#define POOL_PUSH(l, node)                                                     \
+  do {                                                                         \
+    cmark_node *head_ = atomic_load(l);                                        \
+    do                                                                         \
+      (node)->next = head_;                                                    \
+    while (!atomic_compare_exchange_weak(l, &head_, node));                    \
+  } while (0)
+#elif defined(_WIN32)
+#include <windows.h>
+typedef volatile LONG64 pool_count;
+typedef cmark_node *volatile pool_list;
+#define POOL_ADD(c, n) ((size_t)InterlockedExchangeAdd64(c, (LONG64)(n)))
+#define POOL_SUB(c, n) ((size_t)InterlockedExchangeAdd64(c, -(LONG64)(n)))
+#define POOL_LOAD(c) ((size_t)InterlockedCompareExchange64(c, 0, 0))
+#define POOL_TAKE(l) ((cmark_node *)InterlockedExchangePointer((PVOID *)(l), NULL))
+#define POOL_PUSH(l, node)                                                     \
+  do {                                                                         \
+    cmark_node *head_;                                                         \
+    do {                                                                       \
+      head_ = *(l);                                                            \
+      (node)->next = head_;                                                    \
+    } while (InterlockedCompareExchangePointer((PVOID *)(l), node, head_) !=   \
+             head_);                                                           \
+  } while (0)
+#else
+#error "the node pool needs C11 atomics"
+#endif
+
+typedef struct pool_page {
+  struct pool_page *next; // next block, in the first page of a block
+  cmark_node_pool *pool;
+  cmark_node nodes[1];
+} pool_page;
+
+// Size of a page of POOL_MAX_PAGE slots, the stride of a run of pages.
+#define POOL_FULL_PAGE                                                         \
+  (offsetof(pool_page, nodes) + POOL_MAX_PAGE * sizeof(cmark_node))
+
+struct cmark_node_pool {
+  cmark_mem *mem;
+  pool_page *blocks;  // blocks of one or more pages, newest first
+  pool_page *page;    // page slots are handed out from
+  size_t page_used;   // slots handed out from 'page'
+  size_t page_size;   // slots in 'page'
+  size_t run_left;    // full pages following 'page' in its block
+  size_t capacity;    // slots in all pages
+  size_t expected;    // number of nodes the owner expects to allocate
+  size_t allocated;   // nodes handed out so far, freed or not
+  cmark_node *free_list; // freed nodes only the owner takes from
+  pool_list remote_free;
+  pool_count refs;
+};
+
+cmark_node_pool *cmark_node_pool_new(cmark_mem *mem) {
+  cmark_node_pool *pool =
+      (cmark_node_pool *)mem->calloc(1, sizeof(cmark_node_pool));
+  pool->mem = mem;
+  POOL_ADD(&pool->refs, 1);
+  return pool;
+}
+
+static void S_pool_destroy(cmark_node_pool *pool) {
+  pool_page *block = pool->blocks;
+  while (block) {
+    pool_page *next = block->next;
+    pool->mem->free(block);
+    block = next;
+  }
+  pool->mem->free(pool);
+}
+
+void cmark_node_pool_release(cmark_node_pool *pool) {
+  if (pool == NULL)
+    return;
+  if (POOL_SUB(&pool->refs, 1) == 1)
+    S_pool_destroy(pool);
+}
+
+// Sizes the next block of pages so that 'nodes' nodes fit into the pool
+// without growing it piecemeal.
+void cmark_node_pool_expect(cmark_node_pool *pool, size_t nodes) {
+  pool->expected = nodes;
+}
+
+// Returns the number of nodes handed out so far.  Unlike the number of
+// live nodes, this only changes on the owner's thread.
+size_t cmark_node_pool_allocated(cmark_node_pool *pool) {
+  return pool->allocated;
+}
+
+cmark_node *cmark_node_pool_alloc(cmark_node_pool *pool, cmark_mem *mem) {
+  cmark_node *node;
+  uint16_t slot_flags;
+
+  if (pool->free_list == NULL)
+    pool->free_list = POOL_TAKE(&pool->remote_free);
+  if (pool->free_list) {
+    node = pool->free_list;
+    pool->free_list = node->next;
+    slot_flags = node->flags;
+    memset(node, 0, sizeof(*node));
+    node->flags = slot_flags;
+  } else {
+    if (pool->page == NULL || pool->page_used == pool->page_size) {
+      if (pool->run_left) {
+        // The next page of the current run.
+        pool->page = (pool_page *)((char *)pool->page + POOL_FULL_PAGE);
+        pool->run_left--;
+        pool->page_size = POOL_MAX_PAGE;
+      } else {
+        // Room for the nodes still expected comes in one block of up to
+        // POOL_MAX_RUN pages.  Past that the pool grows a page at a time.
+        bool reserve = pool->expected > pool->capacity;
+        size_t size = reserve ? pool->expected - pool->capacity
+                              : pool->capacity / 2;
+        size_t pages = 1;
+        pool_page *block;
+
+        if (size < POOL_MIN_PAGE) {
+          size = POOL_MIN_PAGE;
+        } else if (size > POOL_MAX_PAGE && !reserve) {
+          size = POOL_MAX_PAGE;
+        } else if (size > POOL_MAX_PAGE) {
+          pages = (size + POOL_MAX_PAGE - 1) / POOL_MAX_PAGE;
+          if (pages > POOL_MAX_RUN)
+            pages = POOL_MAX_RUN;
+          size = POOL_MAX_PAGE;
+        }
+        block = (pool_page *)pool->mem->calloc(
+            1, pages == 1
+                   ? offsetof(pool_page, nodes) + size * sizeof(cmark_node)
+                   : pages * POOL_FULL_PAGE);
+        block->next = pool->blocks;
+        pool->blocks = block;
+        pool->page = block;
+        pool->run_left = pages - 1;
+        pool->page_size = size;
+        pool->capacity += pages * size;
+      }
+      pool->page->pool = pool;
+      pool->page_used = 0;
+    }
+    node = &pool->page->nodes[pool->page_used];
+    node->flags = (uint16_t)(CMARK_NODE__POOLED |
+                             (pool->page_used << CMARK_NODE__SLOT_SHIFT));
+    pool->page_used++;
+  }
+
+  POOL_ADD(&pool->refs, 1);
+  pool->allocated++;
+  node->mem = mem;
+  return node;
+}
+
+// Frees a pool and all of its pages, whether or not its nodes have been
+// freed.  A document parsed with CMARK_OPT_COMPACT owns the pool its
+// nodes came from and discards it when it is freed.
+void cmark_node_pool_discard(cmark_node_pool *pool) { S_pool_destroy(pool); }
+
+// Returns the pool a pooled node came from.
+static cmark_node_pool *S_node_pool(cmark_node *node) {
+  size_t slot = (node->flags & CMARK_NODE__SLOT_MASK) >> CMARK_NODE__SLOT_SHIFT;
+  pool_page *page =
+      (pool_page *)((char *)(node - slot) - offsetof(pool_page, nodes));
+  return page->pool;
+}
+
+static void S_pool_free(cmark_node *node) {
+  cmark_node_pool *pool = S_node_pool(node);
+
+  node->flags &= CMARK_NODE__POOLED | CMARK_NODE__SLOT_MASK;
+  POOL_PUSH(&pool->remote_free, node);
+  if (POOL_SUB(&pool->refs, 1) == 1)
+    S_pool_destroy(pool);
+}
+
+// Returns the memory of a single node, wherever it came from.  Nodes
+// from 'discarded', a pool about to be discarded as a whole, are left.
+static void S_node_dealloc(cmark_node *e, cmark_node_pool *discarded) {
+  if (e->flags & CMARK_NODE__POOLED) {
+    if (discarded == NULL || S_node_pool(e) != discarded)
+      S_pool_free(e);
+  } else {
+    e->mem->free(e);
+  }
+}
+
 // Free a cmark_node list and any children.
-static void S_free_nodes(cmark_node *e) {
+static void S_free_nodes(cmark_node *e, cmark_node_pool *discarded) {
   cmark_mem *mem = e->mem;
   cmark_node *next;
   while (e != NULL) {
+    if (!cmark_node__owns_data(e))
+      e->data = NULL;
     switch (e->type) {
     case CMARK_NODE_CODE_BLOCK:
       mem->free(e->data);
@@ -131,6 +351,9 @@ static void S_free_nodes(cmark_node *e) {
     case CMARK_NODE_HTML_INLINE:
     case CMARK_NODE_CODE:
     case CMARK_NODE_HTML_BLOCK:
+    // content that hasn't been parsed into inlines yet
+    case CMARK_NODE_PARAGRAPH:
+    case CMARK_NODE_HEADING:
       mem->free(e->data);
       break;
     case CMARK_NODE_LINK:
@@ -152,15 +375,21 @@ static void S_free_nodes(cmark_node *e) {
       e->next = e->first_child;
     }
     next = e->next;
-    mem->free(e);
+    S_node_dealloc(e, discarded);
     e = next;
   }
 }
 
 void cmark_node_free(cmark_node *node) {
+  cmark_node_pool *pool = NULL;
+
+  if (node->type == CMARK_NODE_DOCUMENT)
+    pool = node->as.document.pool;
   S_node_unlink(node);
   node->next = NULL;
-  S_free_nodes(node);
+  S_free_nodes(node, pool);
+  if (pool)
+    cmark_node_pool_discard(pool);
 }
 
 cmark_node_type cmark_node_get_type(cmark_node *node) {
@@ -311,6 +540,13 @@ const char *cmark_node_get_literal(cmark_node *node) {
   case CMARK_NODE_HTML_INLINE:
   case CMARK_NODE_CODE:
   case CMARK_NODE_CODE_BLOCK:
+    // Borrowed literals aren't NUL-terminated; make a copy.
+    if (node->flags & CMARK_NODE__BORROWED) {
+      unsigned char *data = (unsigned char *)node->mem->calloc(node->len + 1, 1);
+      memcpy(data, node->data, node->len);
+      node->data = data;
+      node->flags &= ~CMARK_NODE__BORROWED;
+    }
     return node->data ? (char *)node->data : "";
 
   default:
@@ -320,6 +556,30 @@ const char *cmark_node_get_literal(cmark_node *node) {
   return NULL;
 }
 
+const char *cmark_node_get_literal_with_len(cmark_node *node, size_t *len) {
+  *len = 0;
+  if (node == NULL) {
+    return NULL;
+  }
+
+  switch (node->type) {
+  case CMARK_NODE_HTML_BLOCK:
+  case CMARK_NODE_TEXT:
+  case CMARK_NODE_HTML_INLINE:
+  case CMARK_NODE_CODE:
+  case CMARK_NODE_CODE_BLOCK:
+    if (node->data == NULL)
+      return "";
+    *len = (size_t)node->len;
+    return (const char *)node->data;
+
+  default:
+    break;
+  }
+
+  return NULL;
+}
+
 int cmark_node_set_literal(cmark_node *node, const char *content) {
   if (node == NULL) {
     return 0;
@@ -331,6 +591,10 @@ int cmark_node_set_literal(cmark_node *node, const char *content) {
   case CMARK_NODE_HTML_INLINE:
   case CMARK_NODE_CODE:
   case CMARK_NODE_CODE_BLOCK:
+    if (!cmark_node__owns_data(node)) {
+      node->data = NULL;
+      node->flags &= ~CMARK_NODE__BORROWED;
+    }
     node->len = cmark_set_cstr(node->mem, &node->data, content);
     return 1;
 
@@ -8,6 +8,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "cmark.h"
 #include "buffer.h"
@@ -46,13 +47,38 @@ typedef struct {
   unsigned char *on_exit;
 } cmark_custom;
 
+typedef struct {
+  // With CMARK_OPT_COMPACT, the pool the parser took the document's
+  // nodes from.  It is discarded as a whole with the document.
+  struct cmark_node_pool *pool;
+  // Size in bytes of the source the document was parsed from, used
+  // to presize render buffers.
+  unsigned int source_size;
+  // Set when the parser stopped early at its memory limit.
+  bool truncated;
+} cmark_document;
+
 enum cmark_node__internal_flags {
   CMARK_NODE__OPEN = (1 << 0),
   CMARK_NODE__LAST_LINE_BLANK = (1 << 1),
   CMARK_NODE__LAST_LINE_CHECKED = (1 << 2),
   CMARK_NODE__LIST_LAST_LINE_BLANK = (1 << 3),
+  // Node was taken from a cmark_node_pool; the bits from
+  // CMARK_NODE__SLOT_SHIFT up hold its slot in the pool page.
+  CMARK_NODE__POOLED = (1 << 5),
+  // 'data' points into the parser's input (CMARK_OPT_BORROW_INPUT): it
+  // isn't owned by the node and isn't NUL-terminated.
+  CMARK_NODE__BORROWED = (1 << 6),
 };
 
+#define CMARK_NODE__SLOT_SHIFT 7
+#define CMARK_NODE__SLOT_MASK (0xFFFFu << CMARK_NODE__SLOT_SHIFT & 0xFFFFu)
+
+// Size of the space for short literals of inline nodes in the node
+// itself, see cmark_node__owns_data.
+#define CMARK_NODE__LITERAL_SIZE 16
+
+
 struct cmark_node {
   cmark_mem *mem;
 
@@ -80,12 +106,54 @@ struct cmark_node {
     cmark_heading heading;
     cmark_link link;
     cmark_custom custom;
+    cmark_document document;
     int html_block_type;
+    // NUL-terminated literal of a text, code or inline HTML node, if
+    // it is short enough.
+    unsigned char literal[CMARK_NODE__LITERAL_SIZE];
   } as;
 };
 
+// Returns true if 'data' was allocated for the node, rather than
+// borrowed from the input or stored in the node itself.
+static inline bool cmark_node__owns_data(const cmark_node *node) {
+  return !(node->flags & CMARK_NODE__BORROWED) &&
+         node->data != node->as.literal;
+}
+
+// Stores a copy of 'len' bytes at 'src' as the literal of an inline
+// node, in the node itself.  Returns false if they don't fit.
+static inline bool cmark_node__set_short_literal(cmark_node *node,
+                                                 const unsigned char *src,
+                                                 bufsize_t len) {
+  if (len >= CMARK_NODE__LITERAL_SIZE)
+    return false;
+  if (len > 0)
+    memcpy(node->as.literal, src, len);
+  node->as.literal[len] = 0;
+  node->data = node->as.literal;
+  node->len = len;
+  return true;
+}
+
 CMARK_EXPORT int cmark_node_check(cmark_node *node, FILE *out);
 
+/* A pool hands out nodes from large pages and recycles freed ones.
+ * Nodes taken from a pool are freed with cmark_node_free as usual; the
+ * pool itself goes away once its owner has released it and its last
+ * node has been freed, or when its owner discards it with all its
+ * nodes.  Only the owner allocates from a pool, but its nodes may be
+ * freed on any thread, also while the owner allocates.
+ */
+typedef struct cmark_node_pool cmark_node_pool;
+
+cmark_node_pool *cmark_node_pool_new(cmark_mem *mem);
+void cmark_node_pool_release(cmark_node_pool *pool);
+void cmark_node_pool_expect(cmark_node_pool *pool, size_t nodes);
+size_t cmark_node_pool_allocated(cmark_node_pool *pool);
+void cmark_node_pool_discard(cmark_node_pool *pool);
+cmark_node *cmark_node_pool_alloc(cmark_node_pool *pool, cmark_mem *mem);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,7 @@
 #include "references.h"
 #include "node.h"
 #include "buffer.h"
+#include "structural.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +16,10 @@ extern "C" {
 struct cmark_parser {
   struct cmark_mem *mem;
   struct cmark_reference_map *refmap;
+  struct cmark_node_pool *pool;
+  // Parses the regions of cmark_parser_reparse, with 'pool'; made on
+  // first use.
+  struct cmark_parser *reparse;
   struct cmark_node *root;
   struct cmark_node *current;
   int line_number;
@@ -27,14 +32,52 @@ struct cmark_parser {
   bool blank;
   bool partially_consumed_tab;
   cmark_strbuf curline;
+  // The line being processed: either a copy in 'curline', or the line
+  // in the input itself, see S_process_line.
+  cmark_chunk line;
   bufsize_t last_line_length;
   cmark_strbuf linebuf;
   cmark_strbuf content;
+  // While the input stays valid (CMARK_OPT_BORROW_INPUT, or until the
+  // end of cmark_parse_document), the current line in the input, if it
+  // can be used in place, and the content of the open leaf block as a
+  // span of the input for as long as it is one.  The content is only
+  // copied to 'content' once it stops being a verbatim slice.
+  bool input_stable;
+  const unsigned char *line_src;
+  const unsigned char *content_src;
+  bufsize_t content_len;
+  // The index of the input, when cmark_parse_document could build one.
+  const cmark_structural_index *index;
+  // How many threads the inlines may be parsed on, see
+  // cmark_parse_document_parallel.
+  int threads;
   int options;
   bool last_buffer_ended_with_cr;
+  bool finished;
+  // Whether the parser made 'root', rather than being given it by
+  // cmark_parser_new_with_mem_into_root.
+  bool own_root;
+  // See cmark_parser_set_memory_limit.  'pool_start' is the number of
+  // nodes the pool had handed out and 'buffers_start' the capacity of
+  // the line and content buffers when the document was started.
+  // 'data_size' is the text held by finished nodes and, once parsed, by
+  // their inlines.
+  size_t memory_limit;
+  size_t pool_start;
+  size_t buffers_start;
+  size_t data_size;
+  bool truncated;
   unsigned int total_size;
 };
 
+// Resets 'parser' and parses all of 'buffer' with it the way
+// cmark_parse_document does, using the buffer in place until the
+// document is finished.  The parser keeps its node pool and buffers, so
+// it can be reused for the next document.
+cmark_node *cmark_parser_parse_buffer(cmark_parser *parser, const char *buffer,
+                                      size_t len, int options);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,3 +1,7 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
 #include "cmark.h"
 #include "utf8.h"
 #include "parser.h"
@@ -15,108 +19,400 @@ static void reference_free(cmark_reference_map *map, cmark_reference *ref) {
   }
 }
 
-// normalize reference:  collapse internal whitespace to single space,
-// remove leading/trailing whitespace, case fold
-// Return NULL if the reference name is actually empty (i.e. composed
-// solely from whitespace)
-static unsigned char *normalize_reference(cmark_mem *mem, cmark_chunk *ref) {
-  cmark_strbuf normalized = CMARK_BUF_INIT(mem);
-  unsigned char *result;
+// Normalizes a reference label into the map's scratch buffer: case
+// folds it, removes leading and trailing whitespace and collapses
+// internal whitespace to a single space.  Returns the length of the
+// result, which is zero if the label is empty or only whitespace.
+static bufsize_t normalize_reference(cmark_reference_map *map,
+                                     cmark_chunk *ref) {
+  cmark_strbuf *buf = &map->label;
+  bool space = false;
+  bufsize_t i, w = 0;
+
+  cmark_strbuf_clear(buf);
+  if (ref == NULL || ref->len == 0)
+    return 0;
+
+  // Most labels are ASCII, which can be folded and collapsed in one pass.
+  cmark_strbuf_grow(buf, ref->len);
+  for (i = 0; i < ref->len; i++) {
+    unsigned char c = ref->data[i];
+
+    if (c >= 0x80 || c == 0)
+      break;
+    if (cmark_isspace(c)) {
+      space = w > 0;
+      continue;
+    }
+    if (space) {
+      buf->ptr[w++] = ' ';
+      space = false;
+    }
+    buf->ptr[w++] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+  }
 
-  if (ref == NULL)
-    return NULL;
+  if (i < ref->len) {
+    cmark_strbuf_clear(buf);
+    cmark_utf8proc_case_fold(buf, ref->data, ref->len);
+    cmark_strbuf_trim(buf);
+    cmark_strbuf_normalize_whitespace(buf);
+    return buf->size;
+  }
 
-  if (ref->len == 0)
-    return NULL;
+  buf->size = w;
+  buf->ptr[w] = '\0';
+  return w;
+}
 
-  cmark_utf8proc_case_fold(&normalized, ref->data, ref->len);
-  cmark_strbuf_trim(&normalized);
-  cmark_strbuf_normalize_whitespace(&normalized);
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                               \
+  do {                                                                         \
+    v0 += v1;                                                                  \
+    v1 = ROTL(v1, 13);                                                         \
+    v1 ^= v0;                                                                  \
+    v0 = ROTL(v0, 32);                                                         \
+    v2 += v3;                                                                  \
+    v3 = ROTL(v3, 16);                                                         \
+    v3 ^= v2;                                                                  \
+    v0 += v3;                                                                  \
+    v3 = ROTL(v3, 21);                                                         \
+    v3 ^= v0;                                                                  \
+    v2 += v1;                                                                  \
+    v1 = ROTL(v1, 17);                                                         \
+    v1 ^= v2;                                                                  \
+    v2 = ROTL(v2, 32);                                                         \
+  } while (0)
+
+// SipHash-1-3 of 'len' bytes at 'in', keyed with 'key'.
+static uint64_t siphash(const uint64_t key[2], const unsigned char *in,
+                        size_t len) {
+  uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+  uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+  uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+  uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+  uint64_t b = (uint64_t)len << 56;
+  uint64_t m;
+  size_t i, j;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    m = 0;
+    for (j = 0; j < 8; j++)
+      m |= (uint64_t)in[i + j] << (8 * j);
+    v3 ^= m;
+    SIPROUND;
+    v0 ^= m;
+  }
+  for (j = 0; i + j < len; j++)
+    b |= (uint64_t)in[i + j] << (8 * j);
+
+  v3 ^= b;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
 
-  result = cmark_strbuf_detach(&normalized);
-  assert(result);
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
 
-  if (result[0] == '\0') {
-    mem->free(result);
-    return NULL;
+// Seeds the hash from the clock and from addresses, which vary between
+// runs where address space layout is randomized.  This only has to keep
+// an attacker from predicting collisions; it doesn't affect the output.
+static void seed_map(cmark_reference_map *map) {
+  uint64_t state = (uint64_t)(uintptr_t)map ^
+                   ((uint64_t)(uintptr_t)&state << 16) ^
+                   ((uint64_t)time(NULL) << 32) ^ (uint64_t)clock();
+  map->seed[0] = splitmix64(&state);
+  map->seed[1] = splitmix64(&state);
+}
+
+// Returns the slot holding the reference for 'label', or the empty
+// slot where it would go.  The table must have an empty slot.
+static cmark_reference **find_slot(cmark_reference_map *map,
+                                   const unsigned char *label,
+                                   uint64_t hash) {
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = (unsigned int)hash & mask;
+  cmark_reference *ref;
+
+  while ((ref = map->table[i]) != NULL) {
+    if (ref->hash == hash &&
+        strcmp((const char *)ref->label, (const char *)label) == 0)
+      break;
+    i = (i + 1) & mask;
   }
+  return &map->table[i];
+}
 
-  return result;
+// Doubles the table, keeping it at most three quarters full.
+static void grow_table(cmark_reference_map *map) {
+  unsigned int old_capacity = map->capacity, i;
+  cmark_reference **old_table = map->table;
+
+  map->capacity = old_capacity ? old_capacity * 2 : 16;
+  map->table = (cmark_reference **)map->mem->calloc(map->capacity,
+                                                    sizeof(*map->table));
+  map->mem_size += (size_t)(map->capacity - old_capacity) * sizeof(*map->table);
+  for (i = 0; i < old_capacity; i++) {
+    cmark_reference *ref = old_table[i];
+    if (ref)
+      *find_slot(map, ref->label, ref->hash) = ref;
+  }
+  map->mem->free(old_table);
+}
+
+// Forgets every cached lookup.
+static void clear_cache(cmark_reference_map *map) {
+  if (map->cache != NULL)
+    memset(map->cache, 0, REFERENCE_CACHE_SIZE * sizeof(*map->cache));
+}
+
+// Puts 'ref', which was defined after the references in 'map', into
+// 'map'.  Returns false, leaving 'ref' to the caller, if its label is
+// taken.
+static bool insert_ref(cmark_reference_map *map, cmark_reference *ref) {
+  cmark_reference **slot;
+
+  if ((map->size + 1) * 4 > map->capacity * 3)
+    grow_table(map);
+  slot = find_slot(map, ref->label, ref->hash);
+  if (*slot != NULL) {
+    map->dropped = true;
+    return false;
+  }
+  *slot = ref;
+  map->size++;
+  return true;
+}
+
+// Returns the reference for a normalized label, if there is one.
+static cmark_reference *find_ref(cmark_reference_map *map,
+                                 const unsigned char *label) {
+  if (map->capacity == 0)
+    return NULL;
+  return *find_slot(map, label,
+                    siphash(map->seed, label, strlen((const char *)label)));
+}
+
+static size_t ref_mem_size(const cmark_reference *ref) {
+  return sizeof(*ref) + strlen((const char *)ref->label) + ref->size;
 }
 
 void cmark_reference_create(cmark_reference_map *map, cmark_chunk *label,
-                            cmark_chunk *url, cmark_chunk *title) {
-  cmark_reference *ref;
-  unsigned char *reflabel = normalize_reference(map->mem, label);
+                            cmark_chunk *url, cmark_chunk *title, int line) {
+  cmark_reference *ref, **slot;
+  bufsize_t label_len = normalize_reference(map, label);
+  uint64_t hash;
 
   /* empty reference name, or composed from only whitespace */
-  if (reflabel == NULL)
+  if (label_len == 0)
     return;
 
-  assert(map->sorted == NULL);
+  if ((map->size + 1) * 4 > map->capacity * 3)
+    grow_table(map);
+
+  hash = siphash(map->seed, map->label.ptr, (size_t)label_len);
+  slot = find_slot(map, map->label.ptr, hash);
+  if (*slot != NULL) {
+    // The first definition of a label wins.
+    map->dropped = true;
+    return;
+  }
 
   ref = (cmark_reference *)map->mem->calloc(1, sizeof(*ref));
-  ref->label = reflabel;
+  ref->label = (unsigned char *)map->mem->calloc(label_len + 1, 1);
+  memcpy(ref->label, map->label.ptr, (size_t)label_len);
   ref->url = cmark_clean_url(map->mem, url);
   ref->title = cmark_clean_title(map->mem, title);
-  ref->age = map->size;
-  ref->next = map->refs;
+  ref->hash = hash;
+  ref->line = line;
 
   if (ref->url != NULL)
     ref->size += (int)strlen((char*)ref->url);
   if (ref->title != NULL)
     ref->size += (int)strlen((char*)ref->title);
 
-  map->refs = ref;
+  *slot = ref;
   map->size++;
+  map->mem_size += sizeof(*ref) + label_len + ref->size;
+  clear_cache(map);
+}
+
+void cmark_reference_map_merge(cmark_reference_map *map,
+                               cmark_reference_map *later) {
+  unsigned int i;
+
+  for (i = 0; i < later->capacity; i++) {
+    cmark_reference *ref = later->table[i];
+
+    if (ref == NULL)
+      continue;
+    later->table[i] = NULL;
+
+    // The maps are seeded differently.
+    ref->hash = siphash(map->seed, ref->label, strlen((char *)ref->label));
+    if (insert_ref(map, ref))
+      map->mem_size += ref_mem_size(ref);
+    else
+      reference_free(later, ref);
+  }
+  map->dropped |= later->dropped;
+  later->size = 0;
+  clear_cache(map);
+  clear_cache(later);
 }
 
-static int
-labelcmp(const unsigned char *a, const unsigned char *b) {
-  return strcmp((const char *)a, (const char *)b);
+static bool same_string(const unsigned char *a, const unsigned char *b) {
+  if (a == NULL || b == NULL)
+    return a == b;
+  return strcmp((const char *)a, (const char *)b) == 0;
 }
 
-static int
-refcmp(const void *p1, const void *p2) {
-  cmark_reference *r1 = *(cmark_reference **)p1;
-  cmark_reference *r2 = *(cmark_reference **)p2;
-  int res = labelcmp(r1->label, r2->label);
-  return res ? res : ((int)r1->age - (int)r2->age);
+static bool same_target(const cmark_reference *a, const cmark_reference *b) {
+  return same_string(a->url, b->url) && same_string(a->title, b->title);
 }
 
-static int
-refsearch(const void *label, const void *p2) {
-  cmark_reference *ref = *(cmark_reference **)p2;
-  return labelcmp((const unsigned char *)label, ref->label);
+static void add_changed(cmark_strbuf *changed, const cmark_reference *ref) {
+  cmark_strbuf_puts(changed, (const char *)ref->label);
+  cmark_strbuf_putc(changed, '\0');
 }
 
-static void sort_references(cmark_reference_map *map) {
-  unsigned int i = 0, last = 0, size = map->size;
-  cmark_reference *r = map->refs, **sorted = NULL;
+bool cmark_reference_map_splice(cmark_reference_map *map, int from, int to,
+                                int delta, cmark_reference_map *defs,
+                                cmark_strbuf *changed) {
+  cmark_reference **refs, *ref, *cur;
+  unsigned int n = 0, nbefore, nkept, i;
+  bool dropped = map->dropped, ok = true;
+
+  for (i = 0; i < map->capacity; i++) {
+    ref = map->table[i];
+    if (ref != NULL && ref->line >= from && ref->line < to)
+      break;
+  }
+  if (i == map->capacity && defs->size == 0) {
+    for (i = 0; i < map->capacity; i++) {
+      ref = map->table[i];
+      if (ref != NULL && ref->line >= to)
+        ref->line += delta;
+    }
+    return true;
+  }
 
-  sorted = (cmark_reference **)map->mem->calloc(size, sizeof(cmark_reference *));
-  while (r) {
-    sorted[i++] = r;
-    r = r->next;
+  // A new definition takes its label unless one before 'from' holds it,
+  // and then changes what the label resolves to unless the definition it
+  // displaces points to the same place.
+  for (i = 0; i < defs->capacity; i++) {
+    ref = defs->table[i];
+    if (ref == NULL)
+      continue;
+    cur = find_ref(map, ref->label);
+    if (cur == NULL || (cur->line >= from && !same_target(cur, ref)))
+      add_changed(changed, ref);
   }
 
-  qsort(sorted, size, sizeof(cmark_reference *), refcmp);
+  // Put back the references before 'from', then the new ones, then those
+  // after, so that the first definition of each label still wins.
+  refs = (cmark_reference **)map->mem->calloc(map->size + 1, sizeof(*refs));
+  for (i = 0; i < map->capacity; i++) {
+    ref = map->table[i];
+    if (ref != NULL && ref->line < from)
+      refs[n++] = ref;
+  }
+  nbefore = n;
+  for (i = 0; i < map->capacity; i++) {
+    ref = map->table[i];
+    if (ref != NULL && ref->line >= to)
+      refs[n++] = ref;
+  }
+  nkept = n;
+  for (i = 0; i < map->capacity; i++) {
+    ref = map->table[i];
+    if (ref != NULL && ref->line >= from && ref->line < to)
+      refs[n++] = ref;
+    map->table[i] = NULL;
+  }
+  map->size = 0;
+
+  for (i = 0; i < nbefore; i++)
+    insert_ref(map, refs[i]);
+  cmark_reference_map_merge(map, defs);
+  for (i = nbefore; i < nkept; i++) {
+    ref = refs[i];
+    ref->line += delta;
+    if (!insert_ref(map, ref)) {
+      map->mem_size -= ref_mem_size(ref);
+      reference_free(map, ref);
+    }
+  }
 
-  for (i = 1; i < size; i++) {
-    if (labelcmp(sorted[i]->label, sorted[last]->label) != 0)
-      sorted[++last] = sorted[i];
+  // A label whose definition went away may fall to one that was dropped
+  // for coming later, which is no longer known.
+  for (i = nkept; i < n; i++) {
+    ref = refs[i];
+    cur = find_ref(map, ref->label);
+    if (cur == NULL && dropped)
+      ok = false;
+    if (cur == NULL || !same_target(cur, ref))
+      add_changed(changed, ref);
+    map->mem_size -= ref_mem_size(ref);
+    reference_free(map, ref);
   }
-  map->sorted = sorted;
-  map->size = last + 1;
+
+  clear_cache(map);
+  map->mem->free(refs);
+  return ok;
+}
+
+// Looks up a raw label, without the expansion limit.  Short labels go
+// through a direct-mapped cache, since documents tend to use the same
+// few labels over and over.
+static cmark_reference *lookup_label(cmark_reference_map *map,
+                                     cmark_chunk *label) {
+  cmark_reference_cache_entry *entry = NULL;
+  cmark_reference *ref = NULL;
+  bufsize_t label_len;
+
+  if (label->len <= REFERENCE_CACHE_KEY_SIZE) {
+    uint64_t hash = siphash(map->seed, label->data, (size_t)label->len);
+
+    if (map->cache == NULL) {
+      map->cache = (cmark_reference_cache_entry *)map->mem->calloc(
+          REFERENCE_CACHE_SIZE, sizeof(*map->cache));
+      map->mem_size += REFERENCE_CACHE_SIZE * sizeof(*map->cache);
+    }
+    entry = &map->cache[hash & (REFERENCE_CACHE_SIZE - 1)];
+    if (entry->len == label->len && entry->hash == hash &&
+        memcmp(entry->key, label->data, (size_t)label->len) == 0)
+      return entry->ref;
+    entry->hash = hash;
+  }
+
+  label_len = normalize_reference(map, label);
+  if (label_len > 0)
+    ref = *find_slot(map, map->label.ptr,
+                     siphash(map->seed, map->label.ptr, (size_t)label_len));
+
+  if (entry != NULL) {
+    entry->ref = ref;
+    entry->len = (unsigned char)label->len;
+    memcpy(entry->key, label->data, (size_t)label->len);
+  }
+  return ref;
 }
 
 // Returns reference if refmap contains a reference with matching
 // label, otherwise NULL.
 cmark_reference *cmark_reference_lookup(cmark_reference_map *map,
                                         cmark_chunk *label) {
-  cmark_reference **ref = NULL;
-  cmark_reference *r = NULL;
-  unsigned char *norm;
+  cmark_reference *r;
 
   if (label->len < 1 || label->len > MAX_LINK_LABEL_LENGTH)
     return NULL;
@@ -124,42 +420,55 @@ cmark_reference *cmark_reference_lookup(cmark_reference_map *map,
   if (map == NULL || !map->size)
     return NULL;
 
-  norm = normalize_reference(map->mem, label);
-  if (norm == NULL)
-    return NULL;
-
-  if (!map->sorted)
-    sort_references(map);
-
-  ref = (cmark_reference **)bsearch(norm, map->sorted, map->size, sizeof(cmark_reference *),
-                refsearch);
-  map->mem->free(norm);
-
-  if (ref != NULL) {
-    r = ref[0];
+  r = lookup_label(map, label);
+  if (r != NULL) {
     /* Check for expansion limit */
-    if (map->max_ref_size && r->size > map->max_ref_size - map->ref_size)
+    if (map->max_ref_size && r->size > map->max_ref_size - map->ref_size) {
+      map->exhausted = true;
       return NULL;
+    }
     map->ref_size += r->size;
   }
 
   return r;
 }
 
-void cmark_reference_map_free(cmark_reference_map *map) {
-  cmark_reference *ref;
+// Keeps the table, cache and label buffer for the next document; a view
+// lets go of the table it shares.
+void cmark_reference_map_clear(cmark_reference_map *map) {
+  unsigned int i;
 
   if (map == NULL)
     return;
 
-  ref = map->refs;
-  while (ref) {
-    cmark_reference *next = ref->next;
-    reference_free(map, ref);
-    ref = next;
+  if (map->shared == NULL) {
+    for (i = 0; i < map->capacity; i++)
+      reference_free(map, map->table[i]);
+    if (map->table != NULL)
+      memset(map->table, 0, map->capacity * sizeof(*map->table));
+  } else {
+    map->table = NULL;
+    map->capacity = 0;
   }
+  clear_cache(map);
+  cmark_strbuf_clear(&map->label);
+  map->size = 0;
+  map->ref_size = 0;
+  map->max_ref_size = 0;
+  map->mem_size = 0;
+  map->shared = NULL;
+  map->exhausted = false;
+  map->dropped = false;
+}
+
+void cmark_reference_map_free(cmark_reference_map *map) {
+  if (map == NULL)
+    return;
 
-  map->mem->free(map->sorted);
+  cmark_reference_map_clear(map);
+  map->mem->free(map->table);
+  map->mem->free(map->cache);
+  cmark_strbuf_free(&map->label);
   map->mem->free(map);
 }
 
@@ -167,5 +476,23 @@ cmark_reference_map *cmark_reference_map_new(cmark_mem *mem) {
   cmark_reference_map *map =
       (cmark_reference_map *)mem->calloc(1, sizeof(cmark_reference_map));
   map->mem = mem;
+  cmark_strbuf_init(mem, &map->label, 0);
+  seed_map(map);
   return map;
 }
+
+cmark_reference_map *cmark_reference_map_view(cmark_reference_map *map) {
+  cmark_reference_map *view =
+      (cmark_reference_map *)map->mem->calloc(1, sizeof(cmark_reference_map));
+  view->mem = map->mem;
+  view->table = map->table;
+  view->capacity = map->capacity;
+  view->size = map->size;
+  view->ref_size = map->ref_size;
+  view->max_ref_size = map->max_ref_size;
+  view->seed[0] = map->seed[0];
+  view->seed[1] = map->seed[1];
+  view->shared = map;
+  cmark_strbuf_init(map->mem, &view->label, 0);
+  return view;
+}
@@ -1,6 +1,9 @@
 #ifndef CMARK_REFERENCES_H
 #define CMARK_REFERENCES_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "chunk.h"
 
 #ifdef __cplusplus
@@ -8,33 +11,81 @@ extern "C" {
 #endif
 
 struct cmark_reference {
-  struct cmark_reference *next;
   unsigned char *label;
   unsigned char *url;
   unsigned char *title;
-  unsigned int age;
+  uint64_t hash; // of the label
   unsigned int size;
+  int line; // where the paragraph that defined it starts
 };
 
 typedef struct cmark_reference cmark_reference;
 
+#define REFERENCE_CACHE_SIZE 128   // a power of two
+#define REFERENCE_CACHE_KEY_SIZE 47 // longest raw label that is cached
+
+// Remembers which reference a raw, unnormalized label resolved to.
+struct cmark_reference_cache_entry {
+  uint64_t hash;
+  cmark_reference *ref; // NULL if the label wasn't found
+  unsigned char len;    // zero for unused entries
+  unsigned char key[REFERENCE_CACHE_KEY_SIZE];
+};
+
+typedef struct cmark_reference_cache_entry cmark_reference_cache_entry;
+
+// An open-addressing hash table keyed by normalized label.  The hash is
+// keyed with a per-map random seed, so that inputs can't be crafted to
+// make every label collide.
 struct cmark_reference_map {
   cmark_mem *mem;
-  cmark_reference *refs;
-  cmark_reference **sorted;
+  cmark_reference **table; // NULL for empty slots
+  unsigned int capacity;   // zero or a power of two
   unsigned int size;
   unsigned int ref_size;
   unsigned int max_ref_size;
+  // Bytes the references, table and cache took up since the map was
+  // last cleared, which is what counts toward a parser's memory limit.
+  size_t mem_size;
+  cmark_reference_cache_entry *cache; // NULL until the first lookup
+  cmark_strbuf label;                 // scratch space for normalizing
+  uint64_t seed[2];
+  // A view made by cmark_reference_map_view shares the table of
+  // 'shared', and notes whether the expansion limit refused a lookup.
+  struct cmark_reference_map *shared;
+  bool exhausted;
+  // Set once a definition was dropped because its label was taken.
+  bool dropped;
 };
 
 typedef struct cmark_reference_map cmark_reference_map;
 
 cmark_reference_map *cmark_reference_map_new(cmark_mem *mem);
+// Returns a view of 'map' with a lookup cache, scratch buffer and
+// expansion budget of its own, starting from what is left of that of
+// 'map', so that several threads can look up labels at once, each in
+// its own view.  'map' must not change while views of it exist.
+cmark_reference_map *cmark_reference_map_view(cmark_reference_map *map);
 void cmark_reference_map_free(cmark_reference_map *map);
+void cmark_reference_map_clear(cmark_reference_map *map);
 cmark_reference *cmark_reference_lookup(cmark_reference_map *map,
                                         cmark_chunk *label);
 void cmark_reference_create(cmark_reference_map *map, cmark_chunk *label,
-                            cmark_chunk *url, cmark_chunk *title);
+                            cmark_chunk *url, cmark_chunk *title, int line);
+// Moves the references of 'later', which were defined after those of
+// 'map', into 'map', leaving 'later' empty.  As within one map, the
+// first definition of a label wins.
+void cmark_reference_map_merge(cmark_reference_map *map,
+                               cmark_reference_map *later);
+// Replaces the references of 'map' defined on lines 'from' to 'to' - 1
+// with those of 'defs', which were defined there instead, and moves the
+// references from line 'to' on by 'delta' lines.  The normalized labels
+// that now resolve differently, or no longer or newly resolve, are added
+// to 'changed', each followed by a NUL.  Returns false if that can't be
+// told because a definition that 'map' dropped may take over a label.
+bool cmark_reference_map_splice(cmark_reference_map *map, int from, int to,
+                                int delta, cmark_reference_map *defs,
+                                cmark_strbuf *changed);
 
 #ifdef __cplusplus
 }
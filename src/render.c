@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include "buffer.h"
 #include "cmark.h"
@@ -18,9 +19,8 @@ static inline void S_blankline(cmark_renderer *renderer) {
   }
 }
 
-static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
-                  cmark_escaping escape) {
-  int length = (int)strlen(source);
+void cmark_render_out(cmark_renderer *renderer, const char *source,
+                      bufsize_t length, bool wrap, cmark_escaping escape) {
   unsigned char nextc;
   int32_t c;
   int i = 0;
@@ -62,7 +62,7 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
     if (len == -1) { // error condition
       return;        // return without rendering rest of string
     }
-    nextc = source[i + len];
+    nextc = i + len < length ? source[i + len] : 0;
     if (c == 32 && wrap) {
       if (!renderer->begin_line) {
         last_nonspace = renderer->buffer->size;
@@ -71,12 +71,12 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
         renderer->begin_line = false;
         renderer->begin_content = false;
         // skip following spaces
-        while (source[i + 1] == ' ') {
+        while (i + 1 < length && source[i + 1] == ' ') {
           i++;
         }
         // We don't allow breaks that make a digit the first character
         // because this causes problems with commonmark output.
-        if (!cmark_isdigit(source[i + 1])) {
+        if (i + 1 == length || !cmark_isdigit(source[i + 1])) {
           renderer->last_breakable = last_nonspace;
         }
       }
@@ -136,6 +136,11 @@ static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
   }
 }
 
+static void S_out(cmark_renderer *renderer, const char *source, bool wrap,
+                  cmark_escaping escape) {
+  cmark_render_out(renderer, source, (bufsize_t)strlen(source), wrap, escape);
+}
+
 // Assumes no newlines, assumes ascii content:
 void cmark_render_ascii(cmark_renderer *renderer, const char *s) {
   int origsize = renderer->buffer->size;
@@ -148,22 +153,21 @@ void cmark_render_code_point(cmark_renderer *renderer, uint32_t c) {
   renderer->column += 1;
 }
 
-char *cmark_render(cmark_node *root, int options, int width,
-                   void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
-                                unsigned char),
-                   int (*render_node)(cmark_renderer *renderer,
-                                      cmark_node *node,
-                                      cmark_event_type ev_type, int options)) {
+void cmark_render_into(cmark_strbuf *buf, cmark_strbuf *pref,
+                       cmark_node *root, int options, int width,
+                       void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
+                                    unsigned char),
+                       int (*render_node)(cmark_renderer *renderer,
+                                          cmark_node *node,
+                                          cmark_event_type ev_type,
+                                          int options)) {
   cmark_mem *mem = root->mem;
-  cmark_strbuf pref = CMARK_BUF_INIT(mem);
-  cmark_strbuf buf = CMARK_BUF_INIT(mem);
   cmark_node *cur;
   cmark_event_type ev_type;
-  char *result;
   cmark_iter *iter = cmark_iter_new(root);
 
   cmark_renderer renderer = {options,
-                             mem,    &buf,    &pref,      0,      width,
+                             mem,    buf,     pref,       0,      width,
                              0,      0,       true,       true,   false,
                              false,  NULL,
                              outc,   S_cr,    S_blankline, S_out};
@@ -185,11 +189,105 @@ char *cmark_render(cmark_node *root, int options, int width,
     }
   }
 
-  result = (char *)cmark_strbuf_detach(renderer.buffer);
-
   cmark_iter_free(iter);
-  cmark_strbuf_free(renderer.prefix);
-  cmark_strbuf_free(renderer.buffer);
+}
+
+char *cmark_render(cmark_node *root, int options, int width,
+                   void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
+                                unsigned char),
+                   int (*render_node)(cmark_renderer *renderer,
+                                      cmark_node *node,
+                                      cmark_event_type ev_type, int options)) {
+  cmark_strbuf pref = CMARK_BUF_INIT(root->mem);
+  cmark_strbuf buf = CMARK_BUF_INIT(root->mem);
+  char *result;
+
+  cmark_render_into(&buf, &pref, root, options, width, outc, render_node);
+  result = (char *)cmark_strbuf_detach(&buf);
+  cmark_strbuf_free(&pref);
 
   return result;
 }
+
+struct cmark_render_context {
+  cmark_mem *mem;
+  cmark_strbuf buffer;
+  cmark_strbuf prefix;
+};
+
+cmark_render_context *cmark_render_context_new(cmark_mem *mem) {
+  cmark_render_context *ctx;
+
+  if (mem == NULL)
+    mem = cmark_get_default_mem_allocator();
+  ctx = (cmark_render_context *)mem->calloc(1, sizeof(*ctx));
+  ctx->mem = mem;
+  cmark_strbuf_init(mem, &ctx->buffer, 0);
+  cmark_strbuf_init(mem, &ctx->prefix, 0);
+  return ctx;
+}
+
+void cmark_render_context_free(cmark_render_context *ctx) {
+  if (ctx == NULL)
+    return;
+  cmark_strbuf_free(&ctx->buffer);
+  cmark_strbuf_free(&ctx->prefix);
+  ctx->mem->free(ctx);
+}
+
+// Empties the buffers and, when a document larger than any seen so far
+// comes along, grows the output buffer up front.  cmark_strbuf_grow
+// rounds the request up by half, which covers the usual markup
+// overhead, so rendering rarely has to reallocate.
+static void S_context_reset(cmark_render_context *ctx, cmark_node *root) {
+  unsigned int size;
+
+  cmark_strbuf_clear(&ctx->buffer);
+  cmark_strbuf_clear(&ctx->prefix);
+  if (root->type != CMARK_NODE_DOCUMENT)
+    return;
+  size = root->as.document.source_size;
+  if (size > 0 && size <= INT32_MAX / 2 && (bufsize_t)size > ctx->buffer.asize)
+    cmark_strbuf_grow(&ctx->buffer, (bufsize_t)size);
+}
+
+size_t cmark_render_context_html(cmark_render_context *ctx, cmark_node *root,
+                                 int options) {
+  S_context_reset(ctx, root);
+  cmark_render_html_into(&ctx->buffer, root, options);
+  return (size_t)ctx->buffer.size;
+}
+
+size_t cmark_render_context_xml(cmark_render_context *ctx, cmark_node *root,
+                                int options) {
+  S_context_reset(ctx, root);
+  cmark_render_xml_into(&ctx->buffer, root, options);
+  return (size_t)ctx->buffer.size;
+}
+
+size_t cmark_render_context_commonmark(cmark_render_context *ctx,
+                                       cmark_node *root, int options,
+                                       int width) {
+  S_context_reset(ctx, root);
+  cmark_render_commonmark_into(&ctx->buffer, &ctx->prefix, root, options,
+                               width);
+  return (size_t)ctx->buffer.size;
+}
+
+size_t cmark_render_context_latex(cmark_render_context *ctx, cmark_node *root,
+                                  int options, int width) {
+  S_context_reset(ctx, root);
+  cmark_render_latex_into(&ctx->buffer, &ctx->prefix, root, options, width);
+  return (size_t)ctx->buffer.size;
+}
+
+size_t cmark_render_context_man(cmark_render_context *ctx, cmark_node *root,
+                                int options, int width) {
+  S_context_reset(ctx, root);
+  cmark_render_man_into(&ctx->buffer, &ctx->prefix, root, options, width);
+  return (size_t)ctx->buffer.size;
+}
+
+const char *cmark_render_context_output(cmark_render_context *ctx) {
+  return (const char *)ctx->buffer.ptr;
+}
@@ -39,6 +39,13 @@ struct cmark_renderer {
 
 typedef struct cmark_renderer cmark_renderer;
 
+// Like renderer->out, for the 'length' bytes at 'source', which need
+// not be NUL-terminated.  Renderers output literals with it straight
+// from the node, since cmark_node_get_literal would copy a borrowed
+// literal into the node.
+void cmark_render_out(cmark_renderer *renderer, const char *source,
+                      bufsize_t length, bool wrap, cmark_escaping escape);
+
 void cmark_render_ascii(cmark_renderer *renderer, const char *s);
 
 void cmark_render_code_point(cmark_renderer *renderer, uint32_t c);
@@ -50,6 +57,27 @@ char *cmark_render(cmark_node *root, int options, int width,
                                       cmark_node *node,
                                       cmark_event_type ev_type, int options));
 
+// Like cmark_render, but appends to 'buf', using 'prefix' (which must
+// be empty) as scratch space.
+void cmark_render_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                       cmark_node *root, int options, int width,
+                       void (*outc)(cmark_renderer *, cmark_escaping, int32_t,
+                                    unsigned char),
+                       int (*render_node)(cmark_renderer *renderer,
+                                          cmark_node *node,
+                                          cmark_event_type ev_type,
+                                          int options));
+
+// The renderers, appending to a buffer; see cmark_render_context.
+void cmark_render_html_into(cmark_strbuf *html, cmark_node *root, int options);
+void cmark_render_xml_into(cmark_strbuf *xml, cmark_node *root, int options);
+void cmark_render_commonmark_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                                  cmark_node *root, int options, int width);
+void cmark_render_latex_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                             cmark_node *root, int options, int width);
+void cmark_render_man_into(cmark_strbuf *buf, cmark_strbuf *prefix,
+                           cmark_node *root, int options, int width);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,437 @@
+#include <stddef.h>
+
+#include "simd.h"
+
+#if defined(CMARK_SIMD_X86)
+#include <immintrin.h>
+#elif defined(CMARK_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+#if !defined(CMARK_SIMD_NEON)
+static const unsigned char *S_skip_scalar(const unsigned char *p,
+                                          const unsigned char *end,
+                                          const cmark_byte_set *set) {
+  (void)end;
+  (void)set;
+  return p;
+}
+
+static const unsigned char *S_utf8_scalar(const unsigned char *p,
+                                          const unsigned char *end) {
+  (void)end;
+  return p;
+}
+#endif
+
+#if defined(CMARK_SIMD_X86) || defined(CMARK_SIMD_NEON)
+
+// Indexes the bytes of [p, p + len) one at a time, for the tail after
+// the last whole block of 64.
+static void S_index_tail(const unsigned char *p, size_t len,
+                         const cmark_byte_set *set, uint64_t *bits) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (set->lo[p[i] & 15] & set->hi[p[i] >> 4])
+      bits[i / 64] |= (uint64_t)1 << (i % 64);
+  }
+}
+
+// UTF-8 validation after Keiser and Lemire, "Validating UTF-8 In Less
+// Than One Instruction Per Byte".  Three table lookups, on the high and
+// low nibble of each byte's predecessor and the high nibble of the byte
+// itself, give a set of error bits that must all be present for a
+// two-byte pattern to be invalid.  The remaining case, a missing or
+// extra continuation byte two or three positions after a lead byte, is
+// checked with saturating subtraction.
+#define TOO_SHORT (1 << 0)  // 11______ 0_______ or 11______ 11______
+#define TOO_LONG (1 << 1)   // 0_______ 10______
+#define OVERLONG_3 (1 << 2) // 11100000 100_____
+#define TOO_LARGE (1 << 3)  // 11110100 1001____ and above
+#define SURROGATE (1 << 4)  // 11101101 101_____
+#define OVERLONG_2 (1 << 5) // 1100000_ 10______
+#define TOO_LARGE_1000 (1 << 6) // 11110101 1000____ and above
+#define OVERLONG_4 (1 << 6) // 11110000 1000____
+#define TWO_CONTS (1 << 7)  // 10______ 10______
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const uint8_t UTF8_BYTE_1_HIGH[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+
+static const uint8_t UTF8_BYTE_1_LOW[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000};
+
+static const uint8_t UTF8_BYTE_2_HIGH[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+        OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+
+// Everything in [start, p) is valid but for a sequence that may be cut
+// off at 'p'.  Backs up to the start of that sequence.
+static const unsigned char *S_utf8_boundary(const unsigned char *start,
+                                            const unsigned char *p) {
+  const unsigned char *q = p;
+  while (q > start && p - q < 3 && (q[-1] & 0xC0) == 0x80)
+    q--;
+  if (q > start && q[-1] >= 0xC0)
+    q--;
+  return q;
+}
+
+#endif
+
+
+#if defined(CMARK_SIMD_X86)
+
+// Returns a bit mask of the bytes of 'v' that are in the set.
+__attribute__((target("ssse3"))) static inline int
+S_classify16(__m128i v, __m128i lo_tbl, __m128i hi_tbl) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  __m128i lo = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(v, nibble));
+  __m128i hi =
+      _mm_shuffle_epi8(hi_tbl, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+  __m128i miss = _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+  return _mm_movemask_epi8(miss) ^ 0xffff;
+}
+
+__attribute__((target("ssse3"))) static const unsigned char *
+S_skip_ssse3(const unsigned char *p, const unsigned char *end,
+             const cmark_byte_set *set) {
+  const __m128i lo_tbl = _mm_loadu_si128((const __m128i *)set->lo);
+  const __m128i hi_tbl = _mm_loadu_si128((const __m128i *)set->hi);
+  int mask;
+
+  while (end - p >= 16) {
+    mask = S_classify16(_mm_loadu_si128((const __m128i *)p), lo_tbl, hi_tbl);
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return p;
+}
+
+__attribute__((target("avx2"))) static const unsigned char *
+S_skip_avx2(const unsigned char *p, const unsigned char *end,
+            const cmark_byte_set *set) {
+  const __m128i lo128 = _mm_loadu_si128((const __m128i *)set->lo);
+  const __m128i hi128 = _mm_loadu_si128((const __m128i *)set->hi);
+  // vpshufb looks up within each 128-bit lane, so both lanes get a copy.
+  const __m256i lo_tbl = _mm256_broadcastsi128_si256(lo128);
+  const __m256i hi_tbl = _mm256_broadcastsi128_si256(hi128);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  unsigned int mask;
+
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i lo = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(v, nibble));
+    __m256i hi = _mm256_shuffle_epi8(
+        hi_tbl, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    __m256i miss =
+        _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+    mask = ~(unsigned int)_mm256_movemask_epi8(miss);
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  if (end - p >= 16) {
+    mask = (unsigned int)S_classify16(_mm_loadu_si128((const __m128i *)p),
+                                      lo128, hi128);
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return p;
+}
+
+__attribute__((target("ssse3"))) static void
+S_index_ssse3(const unsigned char *p, size_t len, const cmark_byte_set *set,
+              uint64_t *bits) {
+  const __m128i lo_tbl = _mm_loadu_si128((const __m128i *)set->lo);
+  const __m128i hi_tbl = _mm_loadu_si128((const __m128i *)set->hi);
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    const unsigned char *q = p + i;
+    bits[i / 64] =
+        (uint64_t)(uint16_t)S_classify16(_mm_loadu_si128((const __m128i *)q),
+                                         lo_tbl, hi_tbl) |
+        (uint64_t)(uint16_t)S_classify16(
+            _mm_loadu_si128((const __m128i *)(q + 16)), lo_tbl, hi_tbl)
+            << 16 |
+        (uint64_t)(uint16_t)S_classify16(
+            _mm_loadu_si128((const __m128i *)(q + 32)), lo_tbl, hi_tbl)
+            << 32 |
+        (uint64_t)(uint16_t)S_classify16(
+            _mm_loadu_si128((const __m128i *)(q + 48)), lo_tbl, hi_tbl)
+            << 48;
+  }
+  S_index_tail(p + i, len - i, set, bits + i / 64);
+}
+
+// Returns a bit mask of the bytes of 'v' that are in the set, given
+// the set's tables copied to both lanes.
+__attribute__((target("avx2"))) static inline uint32_t
+S_classify32(__m256i v, __m256i lo_tbl, __m256i hi_tbl) {
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(v, nibble));
+  __m256i hi = _mm256_shuffle_epi8(
+      hi_tbl, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  __m256i miss =
+      _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+  return ~(uint32_t)_mm256_movemask_epi8(miss);
+}
+
+__attribute__((target("avx2"))) static void
+S_index_avx2(const unsigned char *p, size_t len, const cmark_byte_set *set,
+             uint64_t *bits) {
+  const __m256i lo_tbl = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)set->lo));
+  const __m256i hi_tbl = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)set->hi));
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    uint32_t low = S_classify32(_mm256_loadu_si256((const __m256i *)(p + i)),
+                                lo_tbl, hi_tbl);
+    uint32_t high = S_classify32(
+        _mm256_loadu_si256((const __m256i *)(p + i + 32)), lo_tbl, hi_tbl);
+    bits[i / 64] = (uint64_t)high << 32 | low;
+  }
+  S_index_tail(p + i, len - i, set, bits + i / 64);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i
+S_utf8_errors16(__m128i input, __m128i prev_input) {
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i b1h_tbl = _mm_loadu_si128((const __m128i *)UTF8_BYTE_1_HIGH);
+  const __m128i b1l_tbl = _mm_loadu_si128((const __m128i *)UTF8_BYTE_1_LOW);
+  const __m128i b2h_tbl = _mm_loadu_si128((const __m128i *)UTF8_BYTE_2_HIGH);
+  __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i special = _mm_and_si128(
+      _mm_and_si128(
+          _mm_shuffle_epi8(b1h_tbl,
+                           _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+          _mm_shuffle_epi8(b1l_tbl, _mm_and_si128(prev1, nibble))),
+      _mm_shuffle_epi8(b2h_tbl,
+                       _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+  __m128i must23 =
+      _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                   _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+  __m128i errors = _mm_xor_si128(
+      _mm_and_si128(must23, _mm_set1_epi8((char)0x80)), special);
+  return _mm_or_si128(errors, _mm_cmpeq_epi8(input, _mm_setzero_si128()));
+}
+
+__attribute__((target("ssse3"))) static const unsigned char *
+S_utf8_ssse3(const unsigned char *p, const unsigned char *end) {
+  const unsigned char *start = p;
+  __m128i prev = _mm_setzero_si128();
+
+  while (end - p >= 16) {
+    __m128i input = _mm_loadu_si128((const __m128i *)p);
+    __m128i errors = S_utf8_errors16(input, prev);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(errors, _mm_setzero_si128())) !=
+        0xffff)
+      break;
+    prev = input;
+    p += 16;
+  }
+  return S_utf8_boundary(start, p);
+}
+
+__attribute__((target("avx2"))) static const unsigned char *
+S_utf8_avx2(const unsigned char *p, const unsigned char *end) {
+  const unsigned char *start = p;
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i b1h_tbl = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)UTF8_BYTE_1_HIGH));
+  const __m256i b1l_tbl = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)UTF8_BYTE_1_LOW));
+  const __m256i b2h_tbl = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)UTF8_BYTE_2_HIGH));
+  __m256i prev = _mm256_setzero_si256();
+
+  while (end - p >= 32) {
+    __m256i input = _mm256_loadu_si256((const __m256i *)p);
+    // The high half of 'prev' followed by the low half of 'input', so
+    // that alignr, which works within 128-bit lanes, can shift across.
+    __m256i shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(
+                b1h_tbl, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+            _mm256_shuffle_epi8(b1l_tbl, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(
+            b2h_tbl, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+    __m256i must23 = _mm256_or_si256(
+        _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+        _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    __m256i errors = _mm256_or_si256(
+        _mm256_xor_si256(
+            _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), special),
+        _mm256_cmpeq_epi8(input, _mm256_setzero_si256()));
+    if (!_mm256_testz_si256(errors, errors))
+      break;
+    prev = input;
+    p += 32;
+  }
+  return S_utf8_boundary(start, p);
+}
+
+cmark_simd_utf8_fn cmark_simd_utf8_validator(void) {
+  if (__builtin_cpu_supports("avx2"))
+    return S_utf8_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return S_utf8_ssse3;
+  return S_utf8_scalar;
+}
+
+cmark_simd_skip_fn cmark_simd_skipper(void) {
+  if (__builtin_cpu_supports("avx2"))
+    return S_skip_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return S_skip_ssse3;
+  return S_skip_scalar;
+}
+
+cmark_simd_index_fn cmark_simd_indexer(void) {
+  if (__builtin_cpu_supports("avx2"))
+    return S_index_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return S_index_ssse3;
+  return NULL;
+}
+
+#elif defined(CMARK_SIMD_NEON)
+
+static const unsigned char *S_skip_neon(const unsigned char *p,
+                                        const unsigned char *end,
+                                        const cmark_byte_set *set) {
+  const uint8x16_t lo_tbl = vld1q_u8(set->lo);
+  const uint8x16_t hi_tbl = vld1q_u8(set->hi);
+  const uint8x16_t nibble = vdupq_n_u8(0x0f);
+  uint64_t bits;
+
+  while (end - p >= 16) {
+    uint8x16_t v = vld1q_u8(p);
+    uint8x16_t m = vandq_u8(vqtbl1q_u8(lo_tbl, vandq_u8(v, nibble)),
+                            vqtbl1q_u8(hi_tbl, vshrq_n_u8(v, 4)));
+    // Narrow the 0x00/0xff byte flags to four bits each.
+    uint8x8_t narrowed =
+        vshrn_n_u16(vreinterpretq_u16_u8(vtstq_u8(m, m)), 4);
+    bits = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+    if (bits)
+      return p + (__builtin_ctzll(bits) >> 2);
+    p += 16;
+  }
+  return p;
+}
+
+// Returns a bit mask of the 16 bytes at 'p' that are in the set.
+static inline uint16_t S_classify_neon(const unsigned char *p,
+                                       uint8x16_t lo_tbl, uint8x16_t hi_tbl) {
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t nibble = vdupq_n_u8(0x0f);
+  uint8x16_t v = vld1q_u8(p);
+  uint8x16_t m = vandq_u8(vqtbl1q_u8(lo_tbl, vandq_u8(v, nibble)),
+                          vqtbl1q_u8(hi_tbl, vshrq_n_u8(v, 4)));
+  // Give each flagged byte its bit, then sum each half into one byte.
+  uint8x16_t weighted = vandq_u8(vtstq_u8(m, m), vld1q_u8(weights));
+  return (uint16_t)(vaddv_u8(vget_low_u8(weighted)) |
+                    vaddv_u8(vget_high_u8(weighted)) << 8);
+}
+
+static void S_index_neon(const unsigned char *p, size_t len,
+                         const cmark_byte_set *set, uint64_t *bits) {
+  const uint8x16_t lo_tbl = vld1q_u8(set->lo);
+  const uint8x16_t hi_tbl = vld1q_u8(set->hi);
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64) {
+    bits[i / 64] = (uint64_t)S_classify_neon(p + i, lo_tbl, hi_tbl) |
+                   (uint64_t)S_classify_neon(p + i + 16, lo_tbl, hi_tbl)
+                       << 16 |
+                   (uint64_t)S_classify_neon(p + i + 32, lo_tbl, hi_tbl)
+                       << 32 |
+                   (uint64_t)S_classify_neon(p + i + 48, lo_tbl, hi_tbl)
+                       << 48;
+  }
+  S_index_tail(p + i, len - i, set, bits + i / 64);
+}
+
+static const unsigned char *S_utf8_neon(const unsigned char *p,
+                                        const unsigned char *end) {
+  const unsigned char *start = p;
+  const uint8x16_t b1h_tbl = vld1q_u8(UTF8_BYTE_1_HIGH);
+  const uint8x16_t b1l_tbl = vld1q_u8(UTF8_BYTE_1_LOW);
+  const uint8x16_t b2h_tbl = vld1q_u8(UTF8_BYTE_2_HIGH);
+  const uint8x16_t nibble = vdupq_n_u8(0x0f);
+  uint8x16_t prev = vdupq_n_u8(0);
+
+  while (end - p >= 16) {
+    uint8x16_t input = vld1q_u8(p);
+    uint8x16_t prev1 = vextq_u8(prev, input, 15);
+    uint8x16_t prev2 = vextq_u8(prev, input, 14);
+    uint8x16_t prev3 = vextq_u8(prev, input, 13);
+    uint8x16_t special =
+        vandq_u8(vandq_u8(vqtbl1q_u8(b1h_tbl, vshrq_n_u8(prev1, 4)),
+                          vqtbl1q_u8(b1l_tbl, vandq_u8(prev1, nibble))),
+                 vqtbl1q_u8(b2h_tbl, vshrq_n_u8(input, 4)));
+    uint8x16_t must23 = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                                 vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80)));
+    uint8x16_t errors =
+        vorrq_u8(veorq_u8(vandq_u8(must23, vdupq_n_u8(0x80)), special),
+                 vceqq_u8(input, vdupq_n_u8(0)));
+    if (vmaxvq_u8(errors))
+      break;
+    prev = input;
+    p += 16;
+  }
+  return S_utf8_boundary(start, p);
+}
+
+cmark_simd_utf8_fn cmark_simd_utf8_validator(void) { return S_utf8_neon; }
+
+cmark_simd_skip_fn cmark_simd_skipper(void) { return S_skip_neon; }
+
+cmark_simd_index_fn cmark_simd_indexer(void) { return S_index_neon; }
+
+#else
+
+cmark_simd_skip_fn cmark_simd_skipper(void) { return S_skip_scalar; }
+
+cmark_simd_index_fn cmark_simd_indexer(void) { return NULL; }
+
+cmark_simd_utf8_fn cmark_simd_utf8_validator(void) { return S_utf8_scalar; }
+
+#endif
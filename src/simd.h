@@ -0,0 +1,68 @@
+#ifndef CMARK_SIMD_H
+#define CMARK_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Vector kernels are used on x86 (chosen at run time by CPU features)
+// and on 64-bit ARM, when compiled with GCC or Clang.  Defining
+// CMARK_NO_SIMD (cmake -DCMARK_SIMD=OFF) leaves only the scalar code.
+#if !defined(CMARK_NO_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#if defined(__x86_64__) || defined(__i386__)
+#define CMARK_SIMD_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define CMARK_SIMD_NEON 1
+#endif
+#endif
+
+// A set of ASCII bytes in the form the vector kernels classify with two
+// table lookups: byte c is in the set if lo[c & 15] & hi[c >> 4] is
+// non-zero.  Each bit of the masks stands for one high nibble, so a set
+// can draw on at most eight of them.
+typedef struct {
+  uint8_t lo[16];
+  uint8_t hi[16];
+} cmark_byte_set;
+
+// Skips whole vectors of bytes in [p, end) that are not in 'set'.
+// Returns a pointer to the first byte in the set, or to the start of a
+// tail too short for a vector, which the caller has to scan itself.
+typedef const unsigned char *(*cmark_simd_skip_fn)(const unsigned char *p,
+                                                   const unsigned char *end,
+                                                   const cmark_byte_set *set);
+
+// Returns the best skip kernel for this CPU.  Without vector support
+// it returns 'p' unchanged.
+cmark_simd_skip_fn cmark_simd_skipper(void);
+
+// Sets the bit for each byte of [p, p + len) that is in 'set' in
+// 'bits', a zeroed array of (len + 63) / 64 words.  Byte i goes to bit
+// i % 64 of word i / 64.
+typedef void (*cmark_simd_index_fn)(const unsigned char *p, size_t len,
+                                    const cmark_byte_set *set,
+                                    uint64_t *bits);
+
+// Returns the best index kernel for this CPU, or NULL without vector
+// support, where building an index wouldn't pay for itself.
+cmark_simd_index_fn cmark_simd_indexer(void);
+
+// Skips valid UTF-8 in [p, end) a vector at a time, treating NUL as
+// invalid.  Returns a pointer to a character boundary at or shortly
+// before the first invalid sequence, or before the last partial vector;
+// the caller checks the rest itself.
+typedef const unsigned char *(*cmark_simd_utf8_fn)(const unsigned char *p,
+                                                   const unsigned char *end);
+
+// Returns the best UTF-8 kernel for this CPU.  Without vector support
+// it returns 'p' unchanged.
+cmark_simd_utf8_fn cmark_simd_utf8_validator(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#include "cmark.h"
+#include "inlines.h"
+#include "simd.h"
+#include "structural.h"
+
+// '\n' and '\r' are 0x0a and 0x0d, NUL is 0x00: all in high nibble 0.
+static const cmark_byte_set LINE_END_SET = {
+    {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00,
+     0x00, 0x01, 0x00, 0x00},
+    {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+     0x00, 0x00, 0x00, 0x00}};
+
+bool cmark_structural_index_build(cmark_structural_index *index,
+                                  cmark_mem *mem, const unsigned char *input,
+                                  bufsize_t len, int options) {
+  cmark_simd_index_fn build = cmark_simd_indexer();
+  size_t words = ((size_t)len + 63) / 64;
+
+  index->input = NULL;
+  index->len = 0;
+  index->line_ends = NULL;
+  index->specials = NULL;
+
+  if (build == NULL || len <= 0)
+    return false;
+
+  index->input = input;
+  index->len = len;
+  index->line_ends = (uint64_t *)mem->calloc(words, sizeof(uint64_t));
+  index->specials = (uint64_t *)mem->calloc(words, sizeof(uint64_t));
+  build(input, (size_t)len, &LINE_END_SET, index->line_ends);
+  build(input, (size_t)len, cmark_inline_special_set(options),
+        index->specials);
+  return true;
+}
+
+void cmark_structural_index_free(cmark_structural_index *index,
+                                 cmark_mem *mem) {
+  mem->free(index->line_ends);
+  mem->free(index->specials);
+  index->line_ends = NULL;
+  index->specials = NULL;
+  index->input = NULL;
+  index->len = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef CMARK_STRUCTURAL_H
+#define CMARK_STRUCTURAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bitmaps over a whole input, built in one vector pass before parsing
+// when cmark_parse_document has all of the input at once.  They let the
+// block parser find line endings and the inline parser find the bytes
+// that may start an inline without looking at every byte in between.
+// Bit i of each bitmap stands for input[i].
+typedef struct {
+  const unsigned char *input;
+  bufsize_t len;
+  uint64_t *line_ends; // '\r', '\n' and NUL
+  uint64_t *specials;  // bytes in the inline parser's special set
+} cmark_structural_index;
+
+// Indexes 'input' for parsing with 'options'.  Returns false, leaving
+// 'index' empty, if there is nothing to index or no vector kernel to do
+// it with.
+bool cmark_structural_index_build(cmark_structural_index *index,
+                                  cmark_mem *mem, const unsigned char *input,
+                                  bufsize_t len, int options);
+
+void cmark_structural_index_free(cmark_structural_index *index,
+                                 cmark_mem *mem);
+
+// Returns the position of the first set bit in 'bits' in [pos, end), or
+// 'end' if there is none.  Positions are computed in size_t, as bit
+// positions of the last word can lie past INT32_MAX.
+static inline bufsize_t cmark_structural_next(const uint64_t *bits,
+                                              bufsize_t pos, bufsize_t end) {
+  size_t word, words, found;
+  uint64_t w;
+
+  if (pos >= end)
+    return end;
+
+  word = (size_t)pos / 64;
+  words = ((size_t)end + 63) / 64;
+  w = bits[word] & (~(uint64_t)0 << (pos % 64));
+  while (w == 0) {
+    if (++word == words)
+      return end;
+    w = bits[word];
+  }
+
+  found = word * 64;
+#if defined(__GNUC__) || defined(__clang__)
+  found += (size_t)__builtin_ctzll(w);
+#else
+  while (!(w & 1)) {
+    w >>= 1;
+    found++;
+  }
+#endif
+  return found < (size_t)end ? (bufsize_t)found : end;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+
+#include "thread.h"
+
+#if defined(CMARK_NO_THREADS)
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define MAX_WORKERS 256
+
+#if defined(CMARK_NO_THREADS)
+
+int cmark_thread_count(void) { return 1; }
+
+int cmark_run_tasks(cmark_task_fn fn, void *ctx, size_t ntasks,
+                    int nworkers) {
+  size_t i;
+
+  (void)nworkers;
+  for (i = 0; i < ntasks; i++)
+    fn(ctx, i, 0);
+  return 1;
+}
+
+#else
+
+#if defined(_WIN32)
+typedef CRITICAL_SECTION task_lock;
+#define LOCK_INIT(l) InitializeCriticalSection(l)
+#define LOCK_FREE(l) DeleteCriticalSection(l)
+#define LOCK(l) EnterCriticalSection(l)
+#define UNLOCK(l) LeaveCriticalSection(l)
+#else
+typedef pthread_mutex_t task_lock;
+#define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define LOCK_FREE(l) pthread_mutex_destroy(l)
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+typedef struct {
+  cmark_task_fn fn;
+  void *ctx;
+  size_t ntasks;
+  size_t next; // the lowest task not yet taken
+  task_lock lock;
+} task_queue;
+
+typedef struct {
+  task_queue *queue;
+  int worker;
+} task_worker;
+
+static void S_work(task_queue *queue, int worker) {
+  size_t task;
+
+  for (;;) {
+    LOCK(&queue->lock);
+    task = queue->next;
+    if (task < queue->ntasks)
+      queue->next++;
+    UNLOCK(&queue->lock);
+    if (task >= queue->ntasks)
+      break;
+    queue->fn(queue->ctx, task, worker);
+  }
+}
+
+#if defined(_WIN32)
+
+int cmark_thread_count(void) {
+  SYSTEM_INFO info;
+  DWORD n;
+
+  GetSystemInfo(&info);
+  n = info.dwNumberOfProcessors;
+  return n > 0 ? (n < MAX_WORKERS ? (int)n : MAX_WORKERS) : 1;
+}
+
+static DWORD WINAPI S_thread_main(LPVOID arg) {
+  task_worker *w = (task_worker *)arg;
+  S_work(w->queue, w->worker);
+  return 0;
+}
+
+typedef HANDLE task_thread;
+
+static int S_thread_start(task_thread *thread, task_worker *w) {
+  *thread = CreateThread(NULL, 0, S_thread_main, w, 0, NULL);
+  return *thread != NULL;
+}
+
+static void S_thread_join(task_thread thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+#else
+
+int cmark_thread_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (n < MAX_WORKERS ? (int)n : MAX_WORKERS) : 1;
+}
+
+static void *S_thread_main(void *arg) {
+  task_worker *w = (task_worker *)arg;
+  S_work(w->queue, w->worker);
+  return NULL;
+}
+
+typedef pthread_t task_thread;
+
+static int S_thread_start(task_thread *thread, task_worker *w) {
+  return pthread_create(thread, NULL, S_thread_main, w) == 0;
+}
+
+static void S_thread_join(task_thread thread) { pthread_join(thread, NULL); }
+
+#endif
+
+int cmark_run_tasks(cmark_task_fn fn, void *ctx, size_t ntasks,
+                    int nworkers) {
+  task_queue queue;
+  task_thread threads[MAX_WORKERS];
+  task_worker workers[MAX_WORKERS];
+  int started = 0;
+  int i;
+
+  if (nworkers > MAX_WORKERS)
+    nworkers = MAX_WORKERS;
+  if ((size_t)nworkers > ntasks)
+    nworkers = (int)ntasks;
+
+  queue.fn = fn;
+  queue.ctx = ctx;
+  queue.ntasks = ntasks;
+  queue.next = 0;
+  LOCK_INIT(&queue.lock);
+
+  // Workers that fail to start are simply left out; the others take
+  // their share of the tasks.
+  for (i = 1; i < nworkers; i++) {
+    workers[started].queue = &queue;
+    workers[started].worker = started + 1;
+    if (!S_thread_start(&threads[started], &workers[started]))
+      break;
+    started++;
+  }
+
+  S_work(&queue, 0);
+
+  for (i = 0; i < started; i++)
+    S_thread_join(threads[i]);
+  LOCK_FREE(&queue.lock);
+  return started + 1;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef CMARK_THREAD_H
+#define CMARK_THREAD_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Work is spread over threads with pthreads, or Win32 threads on
+// Windows.  Defining CMARK_NO_THREADS (cmake -DCMARK_THREADS=OFF) runs
+// everything on the calling thread.
+
+// Marks a static variable as having one instance per thread.  This is
+// needed with or without CMARK_NO_THREADS, since callers may run their
+// own threads.
+#if defined(_MSC_VER)
+#define CMARK_THREAD_LOCAL __declspec(thread)
+#else
+#define CMARK_THREAD_LOCAL _Thread_local
+#endif
+
+// Returns the number of processors online, or 1 if it can't tell or
+// without threads.
+int cmark_thread_count(void);
+
+// Does task 'task' on worker 'worker', which is below the number of
+// workers passed to cmark_run_tasks.  A worker does one task at a time,
+// so per-worker state indexed by 'worker' needs no locking.
+typedef void (*cmark_task_fn)(void *ctx, size_t task, int worker);
+
+// Does tasks 0 to 'ntasks' - 1 on up to 'nworkers' threads, the calling
+// thread being worker 0, and returns once all of them are done.  Each
+// worker takes the lowest task not yet taken, so tasks should be of
+// roughly equal size and ordered largest first where they aren't.
+// Returns the number of workers that actually ran, which is smaller
+// than asked for if threads couldn't be started.
+int cmark_run_tasks(cmark_task_fn fn, void *ctx, size_t ntasks,
+                    int nworkers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,12 +8,16 @@
 extern "C" {
 #endif
 
+CMARK_EXPORT
 void cmark_utf8proc_case_fold(cmark_strbuf *dest, const uint8_t *str,
                               bufsize_t len);
 void cmark_utf8proc_encode_char(int32_t uc, cmark_strbuf *buf);
 int cmark_utf8proc_iterate(const uint8_t *str, bufsize_t str_len, int32_t *dst);
 void cmark_utf8proc_check(cmark_strbuf *dest, const uint8_t *line,
                           bufsize_t size);
+// Returns the length of the longest prefix of 'str' that is valid UTF-8
+// and contains no NUL bytes.
+bufsize_t cmark_utf8proc_valid_prefix(const uint8_t *str, bufsize_t len);
 int cmark_utf8proc_is_space(int32_t uc);
 int cmark_utf8proc_is_punctuation_or_symbol(int32_t uc);
 
@@ -7,6 +7,8 @@
 #include "cmark.h"
 #include "node.h"
 #include "buffer.h"
+#include "render.h"
+#include "simd.h"
 
 #define BUFFER_SIZE 100
 #define MAX_INDENT 40
@@ -33,6 +35,13 @@ static const char XML_ESCAPE_TABLE[256] = {
     /* 0xF0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
+// XML_ESCAPE_TABLE as a nibble set for the vector kernels (see simd.h).
+static const cmark_byte_set XML_ESCAPE_SET = {
+    {0x11, 0x11, 0x13, 0x11, 0x11, 0x11, 0x13, 0x11, 0x11, 0x10, 0x10, 0x11,
+     0x15, 0x10, 0x1d, 0x19},
+    {0x01, 0x10, 0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
+     0x00, 0x00, 0x00, 0x00}};
+
 // U+FFFD Replacement Character encoded in UTF-8
 #define UTF8_REPL "\xEF\xBF\xBD"
 
@@ -42,10 +51,13 @@ static const char *XML_ESCAPES[] = {
 
 static void escape_xml(cmark_strbuf *ob, const unsigned char *src,
                        bufsize_t size) {
+  cmark_simd_skip_fn skip = cmark_simd_skipper();
   bufsize_t i = 0, org, esc = 0;
 
   while (i < size) {
     org = i;
+    if (XML_ESCAPE_TABLE[src[i]] == 0)
+      i = (bufsize_t)(skip(src + i, src + size, &XML_ESCAPE_SET) - src);
     while (i < size && (esc = XML_ESCAPE_TABLE[src[i]]) == 0)
       i++;
 
@@ -206,12 +218,10 @@ static int S_render_node(cmark_node *node, cmark_event_type ev_type,
   return 1;
 }
 
-char *cmark_render_xml(cmark_node *root, int options) {
-  char *result;
-  cmark_strbuf xml = CMARK_BUF_INIT(root->mem);
+void cmark_render_xml_into(cmark_strbuf *xml, cmark_node *root, int options) {
   cmark_event_type ev_type;
   cmark_node *cur;
-  struct render_state state = {&xml, 0};
+  struct render_state state = {xml, 0};
 
   cmark_iter *iter = cmark_iter_new(root);
 
@@ -222,8 +232,12 @@ char *cmark_render_xml(cmark_node *root, int options) {
     cur = cmark_iter_get_node(iter);
     S_render_node(cur, ev_type, &state, options);
   }
-  result = (char *)cmark_strbuf_detach(&xml);
 
   cmark_iter_free(iter);
-  return result;
+}
+
+char *cmark_render_xml(cmark_node *root, int options) {
+  cmark_strbuf xml = CMARK_BUF_INIT(root->mem);
+  cmark_render_xml_into(&xml, root, options);
+  return (char *)cmark_strbuf_detach(&xml);
 }
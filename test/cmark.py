@@ -60,6 +60,65 @@ def to_commonmark(lib, text):
 
     return [0, result, '']
 
+class cmark_mem_stats(Structure):
+    _fields_ = [("current", c_size_t),
+                ("peak", c_size_t),
+                ("allocations", c_size_t),
+                ("reallocations", c_size_t),
+                ("largest", c_size_t)]
+
+def to_html_with_memory_limit(lib, text, limit):
+    get_alloc = lib.cmark_get_default_mem_allocator
+    get_alloc.restype = c_void_p
+    counting_mem_new = lib.cmark_counting_mem_new
+    counting_mem_new.restype = c_void_p
+    counting_mem_new.argtypes = [c_void_p]
+    counting_mem_stats = lib.cmark_counting_mem_stats
+    counting_mem_stats.restype = cmark_mem_stats
+    counting_mem_stats.argtypes = [c_void_p]
+    counting_mem_free = lib.cmark_counting_mem_free
+    counting_mem_free.argtypes = [c_void_p]
+
+    parser_new = lib.cmark_parser_new_with_mem
+    parser_new.restype = c_void_p
+    parser_new.argtypes = [c_int, c_void_p]
+    set_limit = lib.cmark_parser_set_memory_limit
+    set_limit.argtypes = [c_void_p, c_size_t]
+    feed = lib.cmark_parser_feed
+    feed.argtypes = [c_void_p, c_char_p, c_size_t]
+    finish = lib.cmark_parser_finish
+    finish.restype = c_void_p
+    finish.argtypes = [c_void_p]
+    parser_free = lib.cmark_parser_free
+    parser_free.argtypes = [c_void_p]
+    is_truncated = lib.cmark_node_is_truncated
+    is_truncated.restype = c_bool
+    is_truncated.argtypes = [c_void_p]
+    render_html = lib.cmark_render_html
+    render_html.restype = POINTER(c_char)
+    render_html.argtypes = [c_void_p, c_int]
+    free_node = lib.cmark_node_free
+    free_node.argtypes = [c_void_p]
+
+    mem = counting_mem_new(get_alloc())
+    free_func = cast(mem, POINTER(cmark_mem)).contents.free
+    textbytes = text.encode('utf-8')
+    # 1 << 17 == CMARK_OPT_UNSAFE
+    parser = parser_new(1 << 17, mem)
+    set_limit(parser, limit)
+    feed(parser, textbytes, len(textbytes))
+    node = finish(parser)
+    parser_free(parser)
+    truncated = is_truncated(node)
+    peak = counting_mem_stats(mem).peak
+    cstring = render_html(node, 1 << 17)
+    result = string_at(cstring).decode('utf-8')
+    free_func(cstring)
+    free_node(node)
+    counting_mem_free(mem)
+
+    return [0, result, truncated, peak]
+
 class CMark:
     def __init__(self, prog=None, library_dir=None):
         self.prog = prog
@@ -85,4 +144,6 @@ class CMark:
             cmark = CDLL(libpath)
             self.to_html = lambda x: to_html(cmark, x)
             self.to_commonmark = lambda x: to_commonmark(cmark, x)
+            self.to_html_with_memory_limit = \
+                lambda x, limit: to_html_with_memory_limit(cmark, x, limit)
 
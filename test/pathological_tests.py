@@ -104,10 +104,10 @@ pathological = {
     "emph in deep blockquote":
                  (">" * 100000 + "a*" * 100000,
                   re.compile(r"^(<\w+>\n)+<p>.*</p>\n(</\w+>\n)+$")),
-    "reference collisions": hash_collisions()
-#    "many references":
-#                 ("".join(map(lambda x: ("[" + str(x) + "]: u\n"), range(1,5000 * 16))) + "[0] " * 5000,
-#                  re.compile("(\\[0\\] ){4999}"))
+    "reference collisions": hash_collisions(),
+    "many references":
+                 ("".join(map(lambda x: ("[" + str(x) + "]: u\n"), range(1,5000 * 16))) + "[0] " * 5000,
+                  re.compile("(\\[0\\] ){4999}"))
     }
 
 pathological_cmark = {
@@ -126,8 +126,25 @@ def run_pathological_cmark(q, inp, prog, lib_dir):
     cmark = CMark(prog=prog, library_dir=lib_dir)
     q.put(cmark.to_commonmark(inp))
 
+# With a memory limit, the parser may stop early; what it returns must
+# still match if it wasn't truncated, and the peak memory use must stay
+# in proportion to the limit.
+MEMORY_LIMIT_SLACK = 4
+
+def run_pathological_limited(q, inp, lib_dir, limit):
+    cmark = CMark(library_dir=lib_dir)
+    rc, actual, truncated, peak = cmark.to_html_with_memory_limit(inp, limit)
+    err = ''
+    if peak > MEMORY_LIMIT_SLACK * limit:
+        rc = 1
+        err = 'peak memory %d bytes with a limit of %d' % (peak, limit)
+    elif truncated:
+        # anything goes
+        actual = ''
+    q.put([rc, actual, err])
+
 def run_tests(args):
-    allowed_failures = {"many references": True}
+    allowed_failures = {}
     TIMEOUT = 5
 
     q = multiprocessing.Queue()
@@ -137,8 +154,20 @@ def run_tests(args):
     ignored = []
 
     print("Testing pathological cases:")
-    for description in (*pathological, *pathological_cmark):
-        if description in pathological:
+    if args.memory_limit:
+        print("with a memory limit of %d bytes" % args.memory_limit)
+        descriptions = pathological
+    else:
+        descriptions = (*pathological, *pathological_cmark)
+    for description in descriptions:
+        if args.memory_limit:
+            (inp, regex) = pathological[description]
+            regex = re.compile(r"^$|" + regex.pattern)
+            p = multiprocessing.Process(
+                target=run_pathological_limited,
+                args=(q, inp, args.library_dir, args.memory_limit)
+            )
+        elif description in pathological:
             (inp, regex) = pathological[description]
             p = multiprocessing.Process(
                 target=run_pathological,
@@ -198,5 +227,8 @@ if __name__ == "__main__":
                     help='program to test')
     parser.add_argument('--library-dir', dest='library_dir', nargs='?',
                     default=None, help='directory containing dynamic library')
+    parser.add_argument('--memory-limit', dest='memory_limit', type=int,
+                    default=0, help='parse with this memory limit (bytes) '
+                    'through the library')
     args = parser.parse_args(sys.argv[1:])
     run_tests(args)
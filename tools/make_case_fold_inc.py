@@ -4,7 +4,13 @@
 import sys, re
 
 prog = re.compile('([0-9A-F]+); [CF];((?: [0-9A-F]+)+);')
-main_table = []
+CF_MAX = 1 << 17
+PAGE_BITS = 6
+PAGE_SIZE = 1 << PAGE_BITS
+
+# Maps code points to their table entry.  Code points without an entry
+# don't change when folded.
+main_table = {}
 repl_table = []
 repl_idx = 0
 test = ''
@@ -28,8 +34,7 @@ for line in sys.stdin:
         test += chr(cp)
         test_result += repl.decode('UTF-8')
 
-    # 17 bits for code point
-    if cp >= (1 << 17):
+    if cp >= CF_MAX:
         raise Exception("code point too large")
 
     # 12 bits for upper bits of replacement index
@@ -42,7 +47,7 @@ for line in sys.stdin:
     if repl_size >= (1 << 3):
         raise Exception("too many replacement chars")
 
-    main_table += [ cp | repl_idx // 2 << 17 | repl_size << 29 ]
+    main_table[cp] = repl_idx // 2 | repl_size << 12
     repl_table += repl
     repl_idx += repl_size
 
@@ -57,40 +62,62 @@ if False:
     print("test_result:", test_result)
     sys.exit(0)
 
+# Split the code points into pages, and store each distinct page once.
+# Page 0 is all zeros, for the pages without any entries.
+pages = [ (0,) * PAGE_SIZE ]
+page_index = []
+for start in range(0, CF_MAX, PAGE_SIZE):
+    page = tuple(main_table.get(cp, 0) for cp in range(start, start + PAGE_SIZE))
+    if page not in pages:
+        pages.append(page)
+    page_index.append(pages.index(page))
+
+if len(pages) > 256:
+    raise Exception("too many pages")
+
+def print_array(values, per_line, fmt, indent="  "):
+    i = 0
+    size = len(values)
+    for value in values:
+        if i % per_line == 0:
+            print(indent, end="")
+        print(fmt % value, end="")
+        i += 1
+        if i == size: print()
+        elif i % per_line == 0: print(",")
+        else: print(", ", end="")
+
 print("""// Generated by tools/make_case_fold_inc.py
 
+// Code points are looked up in two steps: cf_page_index gives the page
+// of cf_pages holding the entries for the %d code points that share
+// everything but their low %d bits.  A zero entry means the code point
+// folds to itself.
 #define CF_MAX            (1 << 17)
-#define CF_TABLE_SIZE     %d
-#define CF_CODE_POINT(x)  ((x) & 0x1FFFF)
-#define CF_REPL_IDX(x)    ((((x) >> 17) & 0xFFF) * 2)
-#define CF_REPL_SIZE(x)   ((x) >> 29)
-
-static const uint32_t cf_table[%d] = {""" % (len(main_table), len(main_table)))
-
-i = 0
-size = len(main_table)
-for value in main_table:
-    if i % 6 == 0:
-        print("  ", end="")
-    print("0x%X" % value, end="")
-    i += 1
-    if i == size: print()
-    elif i % 6 == 0: print(",")
-    else: print(", ", end="")
+#define CF_PAGE_BITS      %d
+#define CF_ENTRY(c)       (cf_pages[cf_page_index[(c) >> CF_PAGE_BITS]] \\
+                                   [(c) & ((1 << CF_PAGE_BITS) - 1)])
+#define CF_REPL_IDX(x)    (((x) & 0xFFF) * 2)
+#define CF_REPL_SIZE(x)   ((x) >> 12)
+
+static const uint8_t cf_page_index[%d] = {""" % (PAGE_SIZE, PAGE_BITS,
+                                                PAGE_BITS, len(page_index)))
+
+print_array(page_index, 16, "%d")
+
+print("""};
+
+static const uint16_t cf_pages[%d][%d] = {""" % (len(pages), PAGE_SIZE))
+
+for n, page in enumerate(pages):
+    print("  {")
+    print_array(page, 8, "0x%04X", "    ")
+    print("  }," if n + 1 < len(pages) else "  }")
 
 print("""};
 
 static const unsigned char cf_repl[%d] = {""" % len(repl_table))
 
-i = 0
-size = len(repl_table)
-for value in repl_table:
-    if i % 12 == 0:
-        print("  ", end="")
-    print("0x%02X" % value, end="")
-    i += 1
-    if i == size: print()
-    elif i % 12 == 0: print(",")
-    else: print(", ", end="")
+print_array(repl_table, 12, "0x%02X")
 
 print("};")
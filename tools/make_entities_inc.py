@@ -1,4 +1,4 @@
-# Creates C data structures for binary lookup table of entities,
+# Creates C data structures for a minimal perfect hash table of entities,
 # using python's html5 entity data.
 # Usage: python3 tools/make_entities_inc.py > src/entities.inc
 
@@ -32,41 +32,85 @@ for (ent, repl) in entities:
     text_table += ent_bytes + repl_bytes
     text_idx += ent_size + repl_size
 
-print("""/* Autogenerated by tools/make_headers_inc.py */
+# Entities are found with hash and displace: the FNV-1a hash of a name
+# picks one of BUCKETS buckets, and the bucket's displacement, mixed into
+# the same hash, picks the name's slot in the main table.  Displacements
+# are chosen bucket by bucket, largest first, so that no two names share
+# a slot.  The C side in houdini_html_u.c must hash the same way.
+BUCKET_BITS = 9
+BUCKETS = 1 << BUCKET_BITS
+HASH_MUL = 0x9E3779B97F4A7C15
+MASK = (1 << 64) - 1
+
+def fnv1a(s):
+    h = 0xCBF29CE484222325
+    for c in s:
+        h = ((h ^ c) * 0x100000001B3) & MASK
+    return h
+
+def bucket_of(h):
+    return ((h * HASH_MUL) & MASK) >> (64 - BUCKET_BITS)
+
+def slot_of(h, d):
+    return ((((h ^ d) * HASH_MUL) & MASK) >> 32) % len(main_table)
+
+buckets = [[] for _ in range(BUCKETS)]
+for (i, (ent, repl)) in enumerate(entities):
+    h = fnv1a(ent.encode('UTF-8'))
+    buckets[bucket_of(h)].append((h, i))
+
+displacements = [0] * BUCKETS
+slots = [None] * len(main_table)
+for b in sorted(range(BUCKETS), key=lambda b: -len(buckets[b])):
+    for d in range(1 << 16):
+        wanted = [slot_of(h, d) for (h, i) in buckets[b]]
+        if len(set(wanted)) == len(wanted) and \
+           all(slots[s] is None for s in wanted):
+            break
+    else:
+        raise Exception("no displacement for bucket %d" % b)
+    for (s, (h, i)) in zip(wanted, buckets[b]):
+        slots[s] = main_table[i]
+    displacements[b] = d
+
+def print_array(values, per_line, fmt):
+    i = 0
+    size = len(values)
+    for value in values:
+        if i % per_line == 0:
+            print("  ", end="")
+        print(fmt % value, end="")
+        i += 1
+        if i == size: print()
+        elif i % per_line == 0: print(",")
+        else: print(", ", end="")
+
+print("""/* Autogenerated by tools/make_entities_inc.py */
 
 #define ENT_MIN_LENGTH      2
 #define ENT_MAX_LENGTH      32
 #define ENT_TABLE_SIZE      %d
+#define ENT_BUCKET_BITS     %d
+#define ENT_HASH_MUL        UINT64_C(0x%X)
 #define ENT_TEXT_IDX(x)     ((x) & 0x7FFF)
 #define ENT_NAME_SIZE(x)    (((x) >> 15) & 0x1F)
 #define ENT_REPL_SIZE(x)    ((x) >> 20)
 
-static const uint32_t cmark_entities[%d] = {""" % (len(main_table), len(main_table)));
+static const uint16_t cmark_entity_displacements[%d] = {""" %
+      (len(main_table), BUCKET_BITS, HASH_MUL, BUCKETS))
 
-i = 0
-size = len(main_table)
-for value in main_table:
-    if i % 6 == 0:
-        print("  ", end="")
-    print("0x%X" % value, end="")
-    i += 1
-    if i == size: print()
-    elif i % 6 == 0: print(",")
-    else: print(", ", end="")
+print_array(displacements, 12, "%d")
+
+print("""};
+
+static const uint32_t cmark_entities[%d] = {""" % len(slots))
+
+print_array(slots, 6, "0x%X")
 
 print("""};
 
 static const unsigned char cmark_entity_text[%d] = {""" % len(text_table))
 
-i = 0
-size = len(text_table)
-for value in text_table:
-    if i % 12 == 0:
-        print("  ", end="")
-    print("0x%02X" % value, end="")
-    i += 1
-    if i == size: print()
-    elif i % 12 == 0: print(",")
-    else: print(", ", end="")
+print_array(text_table, 12, "0x%02X")
 
 print("};")
@@ -0,0 +1,74 @@
+# Creates C lookup tables for the Unicode character classes used by the
+# inline parser, using python's Unicode database.
+# Usage: python3 tools/make_unicode_classes_inc.py > src/unicode_classes.inc
+
+import string, sys, unicodedata
+
+# The tables are only regenerated on purpose, with a python whose
+# database has the version wanted.  Change this when updating Unicode.
+UNICODE_VERSION = '15.0.0'
+
+if unicodedata.unidata_version != UNICODE_VERSION:
+    sys.exit("python has Unicode %s, not %s" %
+             (unicodedata.unidata_version, UNICODE_VERSION))
+
+PAGE_BITS = 6
+PAGE_SIZE = 1 << PAGE_BITS
+
+def is_punctuation_or_symbol(c):
+    if c < 0x80:
+        return chr(c) in string.punctuation
+    return unicodedata.category(chr(c))[0] in 'PS'
+
+# Matches anything in the Zs class, plus LF, CR, TAB, FF.
+def is_space(c):
+    return c in (9, 10, 12, 13) or unicodedata.category(chr(c)) == 'Zs'
+
+def print_array(values, per_line, fmt):
+    i = 0
+    size = len(values)
+    for value in values:
+        if i % per_line == 0:
+            print("  ", end="")
+        print(fmt % value, end="")
+        i += 1
+        if i == size: print()
+        elif i % per_line == 0: print(",")
+        else: print(", ", end="")
+
+# Prints a table with one bit for each code point below NAME_MAX.  The
+# index gives the page holding the bits for each run of PAGE_SIZE code
+# points, and each distinct page is stored once.
+def print_table(name, prop):
+    last = max(c for c in range(0x110000) if prop(c))
+    limit = (last // PAGE_SIZE + 1) * PAGE_SIZE
+
+    pages = [ 0 ]
+    index = []
+    for start in range(0, limit, PAGE_SIZE):
+        page = sum(1 << i for i in range(PAGE_SIZE) if prop(start + i))
+        if page not in pages:
+            pages.append(page)
+        index.append(pages.index(page))
+
+    if len(pages) > 256:
+        raise Exception("too many pages")
+
+    print("""
+#define %s_MAX 0x%X
+
+static const uint8_t %s_index[%d] = {""" % (name.upper(), limit, name,
+                                           len(index)))
+    print_array(index, 16, "%d")
+    print("""};
+
+static const uint64_t %s_pages[%d] = {""" % (name, len(pages)))
+    print_array(pages, 3, "UINT64_C(0x%016X)")
+    print("};")
+
+print("""// Generated by tools/make_unicode_classes_inc.py from Unicode %s
+
+#define UC_PAGE_BITS %d""" % (UNICODE_VERSION, PAGE_BITS))
+
+print_table("uc_punct", is_punctuation_or_symbol)
+print_table("uc_space", is_space)
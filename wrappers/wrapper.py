@@ -18,26 +18,36 @@ else:
     libname = "libcmark.so"
 cmark = CDLL(libname)
 
-class cmark_mem(Structure):
-    _fields_ = [("calloc", c_void_p),
-                ("realloc", c_void_p),
-                ("free", CFUNCTYPE(None, c_void_p))]
+parse_document = cmark.cmark_parse_document
+parse_document.restype = c_void_p
+parse_document.argtypes = [c_char_p, c_size_t, c_int]
 
-get_alloc = cmark.cmark_get_default_mem_allocator
-get_alloc.restype = POINTER(cmark_mem)
-free_func = get_alloc().contents.free
+free_node = cmark.cmark_node_free
+free_node.argtypes = [c_void_p]
 
-markdown = cmark.cmark_markdown_to_html
-markdown.restype = POINTER(c_char)
-markdown.argtypes = [c_char_p, c_size_t, c_int]
+# A render context keeps its output buffer between calls and reports
+# the length of what it rendered, so there is no string to free and no
+# need to scan for the terminating NUL.
+context_new = cmark.cmark_render_context_new
+context_new.restype = c_void_p
+context_new.argtypes = [c_void_p]
+
+render_html = cmark.cmark_render_context_html
+render_html.restype = c_size_t
+render_html.argtypes = [c_void_p, c_void_p, c_int]
+
+context_output = cmark.cmark_render_context_output
+context_output.restype = c_void_p
+context_output.argtypes = [c_void_p]
 
 opts = 0 # defaults
+context = context_new(None)
 
 def md2html(text):
     text = text.encode('utf-8')
-    cstring = markdown(text, len(text), opts)
-    result = string_at(cstring).decode('utf-8')
-    free_func(cstring)
-    return result
+    doc = parse_document(text, len(text), opts)
+    length = render_html(context, doc, opts)
+    free_node(doc)
+    return string_at(context_output(context), length).decode('utf-8')
 
 sys.stdout.write(md2html(sys.stdin.read()))